@@ -0,0 +1,277 @@
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+using str_t = string;  // string type
+
+constexpr size_t synthetic_len = 1 << 16;
+
+struct Run {
+  int exit_code;
+  double wall_s;
+  long peak_rss_kb;
+  str_t err;  // stderr of the process
+};
+
+struct Result {
+  str_t tool, input;
+  size_t input_len, output_len;
+  Run run;
+  bool round_trip;
+  // phases[name] = seconds, summed over iterations
+  map<str_t, double> phases;
+  size_t iter_cnt;
+};
+
+str_t tmp_dir;
+// binaries built by the "G++: build active file" task next to bench, so
+// that they are found from any working directory
+str_t tools_dir, compress_exe, compress2_exe, decompress_exe;
+
+size_t file_len(const str_t &file) {
+  struct stat st;
+  return stat(file.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// Runs argv with stdin and stdout redirected to in_file and out_file.
+Run run(const vector<str_t> &argv, const str_t &in_file,
+        const str_t &out_file) {
+  const str_t err_file = tmp_dir + "/stderr";
+  const auto start = chrono::steady_clock::now();
+  const pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Error: cannot fork.\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    constexpr int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    const int in = open(in_file.c_str(), O_RDONLY);
+    const int out = open(out_file.c_str(), flags, 0644);
+    const int err = open(err_file.c_str(), flags, 0644);
+    if (in == -1 || out == -1 || err == -1) _exit(127);
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+    vector<char *> args;
+    for (const str_t &arg : argv) {
+      args.push_back(const_cast<char *>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+    execv(args[0], args.data());
+    _exit(127);
+  }
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  const chrono::duration<double> wall = chrono::steady_clock::now() - start;
+  stringstream err;
+  err << ifstream(err_file).rdbuf();
+  return {WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+          wall.count(), usage.ru_maxrss, err.str()};
+}
+
+bool is_name_char(const char ch) { return isalnum(uint8_t(ch)) || ch == '_'; }
+
+// Collects "name: 1.234s" from the lines printed by the compressors.
+void get_phases(Result &result) {
+  const str_t &err = result.run.err;
+  result.iter_cnt = 0;
+  for (size_t pos = 0; (pos = err.find(": ", pos)) != str_t::npos; pos++) {
+    size_t begin = pos;
+    while (begin && is_name_char(err[begin - 1])) begin--;
+    char *end;
+    const double sec = strtod(err.c_str() + pos + 2, &end);
+    if (begin == pos || end == err.c_str() + pos + 2 || *end != 's') continue;
+    const str_t name = err.substr(begin, pos - begin);
+    // the sum of the others, printed by compress2
+    if (name == "total") continue;
+    result.phases[name] += sec;
+  }
+  for (size_t pos = 0; (pos = err.find("iter #", pos)) != str_t::npos;) {
+    result.iter_cnt++;
+    pos++;
+  }
+}
+
+// Compresses input_files, which are reported as input, as a batch if there
+// are several of them, which only compress supports.
+Result bench(const str_t &tool, const str_t &input,
+             const vector<str_t> &input_files) {
+  const str_t output = tmp_dir + "/output";
+  Result result = {tool, input, 0, 0, {}, false, {}, 0};
+  for (const str_t &input_file : input_files) {
+    result.input_len += file_len(input_file);
+  }
+  if (tool == "compress" && input_files.size() > 1) {
+    vector<str_t> argv = {compress_exe};
+    argv.insert(argv.end(), input_files.begin(), input_files.end());
+    result.run = run(argv, "/dev/null", output);
+  } else if (tool == "compress") {
+    result.run = run({compress_exe}, input_files[0], output);
+  } else {
+    result.run =
+        run({compress2_exe, input_files[0], output}, "/dev/null", "/dev/null");
+  }
+  get_phases(result);
+  result.output_len = file_len(output);
+  vector<str_t> argv = {decompress_exe, output};
+  argv.insert(argv.end(), input_files.begin(), input_files.end());
+  result.round_trip = result.run.exit_code == 0 &&
+                      run(argv, "/dev/null", "/dev/null").exit_code == 0;
+  unlink(output.c_str());
+  return result;
+}
+
+// Writes synthetic_len bytes of assembly-like text, lines of tokens from a
+// small vocabulary, which compresses well.
+str_t get_repetitive() {
+  const str_t file = tmp_dir + "/repetitive";
+  mt19937 rng(20210317);
+  vector<str_t> vocab;
+  for (int i = 0; i < 64; i++) {
+    str_t &word = vocab.emplace_back(rng() % 2 ? "\t" : "");
+    for (int len = 2 + rng() % 8; len--;) word += 'a' + rng() % 26;
+  }
+  str_t doc;
+  while (doc.length() < synthetic_len) {
+    for (int cnt = 1 + rng() % 4; cnt--;) {
+      doc += vocab[rng() % vocab.size()];
+      doc += cnt ? ", " : "\n";
+    }
+  }
+  doc.resize(synthetic_len);
+  ofstream(file, ios::binary) << doc;
+  return file;
+}
+
+// Writes synthetic_len random bytes, '\0' included, which hardly compress.
+str_t get_random() {
+  const str_t file = tmp_dir + "/random";
+  mt19937 rng(20210317);
+  str_t doc;
+  while (doc.length() < synthetic_len) doc += char(rng());
+  ofstream(file, ios::binary) << doc;
+  return file;
+}
+
+// Writes the 256 byte values once each, so that no two suffixes share a
+// first byte.
+str_t get_distinct() {
+  const str_t file = tmp_dir + "/distinct";
+  str_t doc;
+  for (int ch = 0; ch < 256; ch++) doc += char(ch);
+  ofstream(file, ios::binary) << doc;
+  return file;
+}
+
+// Writes two files of one distinct byte each, a batch in which every byte
+// and every separator is distinct.
+vector<str_t> get_distinct_batch() {
+  vector<str_t> files;
+  for (const char *name : {"a", "b"}) {
+    files.push_back(tmp_dir + "/" + name);
+    ofstream(files.back(), ios::binary) << name;
+  }
+  return files;
+}
+
+str_t json_str(const str_t &str) {
+  str_t ret = "\"";
+  for (const char &ch : str) {
+    if (uint8_t(ch) < 0x20) {
+      char esc[7];
+      snprintf(esc, sizeof(esc), "\\u%04x", ch);
+      ret += esc;
+      continue;
+    }
+    if (ch == '"' || ch == '\\') ret += '\\';
+    ret += ch;
+  }
+  return ret + "\"";
+}
+
+void print_json(const vector<Result> &results) {
+  printf("[\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    printf("  {\"tool\": %s, \"input\": %s, ", json_str(r.tool).c_str(),
+           json_str(r.input).c_str());
+    printf("\"input_len\": %zu, \"output_len\": %zu, \"ratio\": %.4f, ",
+           r.input_len, r.output_len,
+           r.input_len ? double(r.output_len) / r.input_len : 0.0);
+    printf("\"exit_code\": %d, \"round_trip\": %s, ", r.run.exit_code,
+           r.round_trip ? "true" : "false");
+    printf("\"wall_s\": %.3f, \"peak_rss_kb\": %ld, \"iter_cnt\": %zu, ",
+           r.run.wall_s, r.run.peak_rss_kb, r.iter_cnt);
+    printf("\"phases\": {");
+    for (bool first = true; const auto &[name, sec] : r.phases) {
+      printf("%s%s: %.3f", first ? "" : ", ", json_str(name).c_str(), sec);
+      first = false;
+    }
+    printf("}}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  printf("]\n");
+}
+
+// Usage: bench [input_file...]
+// Runs compress and compress2 over the input files (by default
+// tools/compress.in and synthetic inputs, the last of which is a batch for
+// compress alone), checks that decompress restores each input, and prints a
+// JSON array of the results.
+int main(int argc, const char *argv[]) {
+  const str_t exe = argv[0];
+  const size_t slash = exe.rfind('/');
+  tools_dir = slash == str_t::npos ? "." : exe.substr(0, slash);
+  compress_exe = tools_dir + "/compress";
+  compress2_exe = tools_dir + "/compress2";
+  decompress_exe = tools_dir + "/decompress";
+  char dir[] = "/tmp/bench.XXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    fprintf(stderr, "Error: cannot create a temporary directory.\n");
+    exit(1);
+  }
+  tmp_dir = dir;
+  // inputs = {{input, {input_file...}}...}
+  vector<pair<str_t, vector<str_t>>> inputs;
+  for (int i = 1; i < argc; i++) inputs.push_back({argv[i], {argv[i]}});
+  if (inputs.empty()) {
+    inputs = {{"tools/compress.in", {tools_dir + "/compress.in"}},
+              {"synthetic:repetitive", {get_repetitive()}},
+              {"synthetic:random", {get_random()}},
+              {"synthetic:distinct", {get_distinct()}},
+              {"synthetic:distinct_batch", get_distinct_batch()}};
+  }
+  vector<Result> results;
+  for (const auto &[input, input_files] : inputs) {
+    for (const str_t tool : {"compress", "compress2"}) {
+      if (tool == "compress2" && input_files.size() > 1) continue;
+      fprintf(stderr, "%s %s\n", tool.c_str(), input.c_str());
+      results.push_back(bench(tool, input, input_files));
+    }
+  }
+  print_json(results);
+  for (const char *file :
+       {"repetitive", "random", "distinct", "a", "b", "stderr"}) {
+    unlink((tmp_dir + "/" + file).c_str());
+  }
+  rmdir(dir);
+  return all_of(results.begin(), results.end(),
+                [](const Result &r) { return r.round_trip; })
+             ? 0
+             : 4;
+}
@@ -1,155 +1,397 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
-#include <deque>
+#include <cstdlib>
 #include <functional>
 #include <iterator>
-#include <map>
-#include <unordered_map>
-#include <unordered_set>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <ranges>
+#include <string_view>
+#include <thread>
 #include <vector>
-using namespace std;
-
-struct MyHash {
-  size_t _h;
-  operator const size_t &() const { return _h; }
-  MyHash(size_t h = 0) : _h(h) {}
-  MyHash &append(const MyHash &e, size_t len = 1) {
-    while (len--) _h *= 0x1000193;
-    _h += e._h;
-    return *this;
-  }
-  bool operator==(const MyHash &e) const { return _h == e._h; }
-};
 
-template <>
-struct std::hash<MyHash> {
-  size_t operator()(const MyHash &e) const { return e._h; }
-};
+#include "keywords.h"
+using namespace std;
 
 enum Constant : size_t {
   buf_size = 1 << 20,
-  lookup_len = 256,
-  document_id = buf_size,
+  no_id = numeric_limits<size_t>::max(),
 };
 constexpr char null_ew_symbol[] = "`null`";
-char buf[buf_size];
+// buf[0 ... n - 1] are the input files, each followed by a separator
+const char *buf;
+// doc_pos[k] = position in buf of the k-th input file, doc_pos.back() = n
+vector<size_t> doc_pos;
 
-vector<size_t> id_list;
-// dict[hash] = {pos/id, len}
-unordered_map<MyHash, pair<size_t, size_t>> dict;
+// ids are numbered in order of discovery, and the documents, which span the
+// input files, come last: document_id ... tab.size() - 1
+size_t document_id;
+// id2pos[id] = position in buf of the leftmost occurrence
+vector<size_t> id2pos;
+// ids that the documents depend on, in order of increasing length
+vector<size_t> def_list;
+// suffix array, rank array, height array of buf[0 ... n - 1]
+vector<size_t> sa, rk, hgt;
 // tab[id] = {len, substitutions = {ids...}}
-map<size_t, pair<size_t, vector<size_t>>> tab;
+vector<pair<size_t, vector<size_t>>> tab;
 // sym[id] = symbol
-map<size_t, reference_wrapper<string>::type> sym;
+vector<reference_wrapper<string>::type> sym;
 // def[id][ew_symbol?] = string of definition
-map<size_t, array<string, 2>> def;
+vector<array<string, 2>> def;
 // ref[id][ew_symbol?] = {ids...}
-map<size_t, array<vector<size_t>, 2>> ref;
+vector<array<vector<size_t>, 2>> ref;
 // refcnt[id] = reference count
-map<size_t, ptrdiff_t> refcnt;
-
-size_t id2pos(size_t id) { return id == document_id ? 0 : id; }
-
-// ret[_] = {hash, pos/id, len}
-vector<tuple<MyHash, size_t, size_t>> get_matches(const size_t id,
-                                                  const size_t len) {
-  decltype(get_matches(id, len)) matches;
-  MyHash h;
-  for (size_t j = 0; j < len; j++) {
-    h.append(buf[id + j]);
-    if (dict.count(h)) {
-      const auto &match = dict.at(h);
-      matches.push_back({h, match.first, match.second});
-      assert(get<2>(matches.back()) == j + 1);
+vector<ptrdiff_t> refcnt;
+// --time-budget in seconds and --mem-budget in MB, unlimited by default
+double time_budget = numeric_limits<double>::infinity();
+double mem_budget = numeric_limits<double>::infinity();
+
+// @return  seconds elapsed since the previous call.
+double lap() {
+  static auto last = chrono::steady_clock::now();
+  const auto now = chrono::steady_clock::now();
+  const chrono::duration<double> elapsed = now - last;
+  last = now;
+  return elapsed.count();
+}
+
+// @return  seconds elapsed since the first call.
+double uptime() {
+  static const auto start = chrono::steady_clock::now();
+  const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// @return  whether a step expected to take step_time seconds would overrun
+// --time-budget, or the peak memory has overrun --mem-budget.
+bool over_budget(const double step_time) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return uptime() + step_time > time_budget ||
+         usage.ru_maxrss / 1024.0 > mem_budget;
+}
+
+// Removes "--time-budget SECONDS" and "--mem-budget MB" from args.
+void get_budgets(vector<const char *> &args) {
+  for (size_t i = 0; i < args.size();) {
+    const string_view arg = args[i];
+    double *const budget = arg == "--time-budget" ? &time_budget
+                           : arg == "--mem-budget" ? &mem_budget
+                                                   : nullptr;
+    if (budget == nullptr) {
+      i++;
+      continue;
     }
+    char *end = nullptr;
+    if (i + 1 < args.size()) *budget = strtod(args[i + 1], &end);
+    if (end == nullptr || end == args[i + 1] || *end || !(*budget > 0)) {
+      fprintf(stderr, "Error: %s expects a positive number.\n", args[i]);
+      exit(1);
+    }
+    args.erase(args.begin() + i, args.begin() + i + 2);
   }
-  assert(matches.size() > 0);
-  return matches;
 }
 
-// time: O(file_size * lookup_len)
-// space: O(file_size * lookup_len)
-void get_tab() {
-  size_t file_size = fread(buf, 1, buf_size, stdin);
-  if (file_size == buf_size) {
+// Maps the input read-only in front of a zero page, so that the document is
+// never copied and buf[file_size] = '\0'.  Pipes are read into memory.
+void read_input(const int fd) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    static const auto data = make_unique_for_overwrite<char[]>(buf_size);
+    size_t file_size = 0;
+    while (file_size < buf_size) {
+      const ssize_t ret = read(fd, &data[file_size], buf_size - file_size);
+      if (ret == -1 && errno == EINTR) continue;
+      if (ret == -1) {
+        fprintf(stderr, "Error: cannot read the input.\n");
+        exit(1);
+      }
+      if (ret == 0) break;
+      file_size += ret;
+    }
+    if (file_size == buf_size) {
+      fprintf(stderr, "Error: buf is not large enough.\n");
+      exit(1);
+    }
+    data[file_size] = '\0';
+    buf = data.get();
+    doc_pos = {0, file_size + 1};
+    return;
+  }
+  const size_t file_size = st.st_size;
+  if (file_size >= buf_size) {
     fprintf(stderr, "Error: buf is not large enough.\n");
     exit(1);
   }
-  // get dict
-  for (size_t id = 0; id < file_size; id++) {
-    auto h = MyHash{}.append(buf[id]);
-    if (dict.count(h) == 0) {
-      dict[h] = {id, 1};
-      tab[id] = {1, vector<size_t>{}};
-    }
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t map_size = (file_size + page_size) / page_size * page_size;
+  void *addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+  if (addr != MAP_FAILED && file_size) {
+    addr = mmap(addr, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
   }
-  // Q[_] = {hash, pos/id, len}
-  deque<tuple<MyHash, size_t, size_t>> Q;
-  for (size_t id = 0; id < file_size;) {
-    const auto [match_hash, match_pos, match_len] =
-        get_matches(id, min<size_t>(file_size - id, lookup_len)).back();
-    Q.push_back({MyHash{}, id, 0});
-    for (auto &[q_hash, q_pos, q_len] : Q) {
-      q_len += match_len;
-      if (q_len > lookup_len) continue;
-      q_hash.append(match_hash, match_len);
-      if (dict.count(q_hash) == 0) {
-        dict[q_hash] = {q_pos, q_len};
-      }
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "Error: cannot map the input.\n");
+    exit(1);
+  }
+  buf = static_cast<const char *>(addr);
+  doc_pos = {0, file_size + 1};
+}
+
+// Reads input_files one after another into buf, which is copied this time.
+void read_inputs(const vector<const char *> &input_files) {
+  static vector<char> data;
+  doc_pos = {0};
+  for (const char *input_file : input_files) {
+    const int fd = open(input_file, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+      fprintf(stderr, "Error: cannot read file '%s'\n", input_file);
+      exit(1);
     }
-    while (!Q.empty() && get<2>(Q.front()) > lookup_len) Q.pop_front();
-    if (id != match_pos) {
-      tab[id] = {match_len, vector<size_t>{}};
-      auto &subs = tab[id].second;
-      for (size_t j = 0; j < match_len;) {
-        assert(tab.count(match_pos + j));
-        subs.push_back(match_pos + j);
-        j += tab[match_pos + j].first;
-      }
-      if (subs.size() > 1) {
-        dict[match_hash] = {id, match_len};
+    const size_t pos = data.size();
+    data.resize(pos + st.st_size + 1);
+    if (data.size() > buf_size) {
+      fprintf(stderr, "Error: buf is not large enough.\n");
+      exit(1);
+    }
+    for (size_t len = 0; len < size_t(st.st_size);) {
+      const ssize_t ret = read(fd, &data[pos + len], st.st_size - len);
+      if (ret == -1 && errno == EINTR) continue;
+      if (ret <= 0) {
+        fprintf(stderr, "Error: cannot read file '%s'\n", input_file);
+        exit(1);
       }
+      len += ret;
+    }
+    close(fd);
+    data.back() = '\0';
+    doc_pos.push_back(data.size());
+  }
+  buf = data.data();
+}
+
+// Writes out[0 ... len - 1] to fd with a single write() unless it is short.
+void write_output(const int fd, const char *out, size_t len) {
+  while (len) {
+    const ssize_t ret = write(fd, out, len);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret == -1) {
+      fprintf(stderr, "Error: cannot write the output.\n");
+      exit(1);
+    }
+    out += ret;
+    len -= ret;
+  }
+}
+
+// Prefix doubling over buf[0 ... n - 1]. The separator after the k-th file
+// ranks k, below every byte, which are ranked by m + buf[pos], so that
+// separators are unique and no common prefix spans two files.
+// time: O(n * log(n))
+void get_sa(const size_t n) {
+  const size_t m = doc_pos.size() - 1, alphabet = m + 256;
+  sa.resize(n);
+  rk.resize(n);
+  hgt.assign(n, 0);
+  vector<size_t> bucket(max(n, alphabet), 0), sa2(n);
+  for (size_t pos = 0; pos < n; pos++) rk[pos] = m + uint8_t(buf[pos]);
+  for (size_t k = 0; k < m; k++) rk[doc_pos[k + 1] - 1] = k;
+  for (size_t pos = 0; pos < n; pos++) bucket[rk[pos]]++;
+  const size_t char_cnt =
+      alphabet - count(bucket.begin(), bucket.begin() + alphabet, 0);
+  partial_sum(bucket.begin(), bucket.begin() + alphabet, bucket.begin());
+  for (size_t pos = n; pos--;) sa[--bucket[rk[pos]]] = pos;
+  for (size_t j = 1, rk_cnt = char_cnt, bucket_len = alphabet; rk_cnt < n;
+       j *= 2) {
+    size_t cnt = 0;
+    for (size_t pos = n - j; pos < n; pos++) sa2[cnt++] = pos;
+    for (size_t i = 0; i < n; i++) {
+      if (sa[i] >= j) sa2[cnt++] = sa[i] - j;
+    }
+    fill(bucket.begin(), bucket.begin() + bucket_len, 0);
+    for (size_t pos = 0; pos < n; pos++) bucket[rk[pos]]++;
+    partial_sum(bucket.begin(), bucket.begin() + bucket_len, bucket.begin());
+    for (size_t i = n; i--;) sa[--bucket[rk[sa2[i]]]] = sa2[i];
+    swap(rk, sa2);
+    rk_cnt = 0;
+    rk[sa[0]] = 0;
+    for (size_t i = 1; i < n; i++) {
+      // the unique separators keep sa[_] + j in range when the first halves
+      // match
+      rk_cnt += sa2[sa[i - 1]] != sa2[sa[i]] ||
+                sa2[sa[i - 1] + j] != sa2[sa[i] + j];
+      rk[sa[i]] = rk_cnt;
     }
-    id += match_len;
-  }
-  fprintf(stderr, "dict.size() = %zu\n", dict.size());
-  // shrink dict
-  dict.clear();
-  for (const auto &[id, second] : tab) {
-    const size_t &len = second.first;
-    MyHash h{};
-    for (size_t j = 0; j < len; j++) h.append(buf[id + j]);
-    if (dict.count(h) == 0) dict[h] = {id, len};
-  }
-
-  // insert the document_id to simplify the code
-  id_list.reserve(tab.size() + 1);
-  for (const auto &p : tab) id_list.push_back(p.first);
-  tab[document_id] = {file_size, id_list};
-  id_list.push_back(document_id);
-
-  // use shrunk dict to reprduce tab
-  for (auto &[id, second] : tab) {
-    auto &[len, subs] = second;
-    if (len <= 1) continue;
-    using dp_tuple = tuple<size_t, size_t, size_t>;  // {size, prev, id}
-    vector<dp_tuple> dp(len + 1, {buf_size, 0, 0});
+    bucket_len = ++rk_cnt;
+  }
+  // the doubling does not run when all the ranks are distinct from the
+  // start, which leaves rk[pos] = m + buf[pos] rather than the position of
+  // pos in sa
+  for (size_t i = 0; i < n; i++) rk[sa[i]] = i;
+  for (size_t pos = 0, k = 0; pos < n; pos++) {
+    if (rk[pos] == 0) continue;
+    const size_t prev = sa[rk[pos] - 1];
+    // sep(pos) = position of the separator after pos
+    const auto sep = [](const size_t pos) {
+      return *ranges::upper_bound(doc_pos, pos) - 1;
+    };
+    const size_t end = min(sep(pos) - pos, sep(prev) - prev);
+    while (k < end && buf[pos + k] == buf[prev + k]) k++;
+    hgt[rk[pos]] = k;
+    if (k) k--;
+  }
+}
+
+// Every repeated substring that is the longest common prefix of some
+// adjacent suffixes (i.e. the label of an lcp-interval) becomes an id, and
+// so does every character.
+// time: O(file_size * log(file_size)) plus the tokenization of the ids that
+// the document depends on
+void get_tab() {
+  const size_t n = doc_pos.back(), m = doc_pos.size() - 1;
+  get_sa(n);
+
+  // enumerate lcp-intervals bottom-up with a stack of {len, id, pos, lb}
+  // hgt_id[i] = id of the lcp-interval labeled by hgt[i]
+  vector<size_t> hgt_id(n + 1, no_id);
+  // pfx[id] = id of the longest proper prefix among lcp-interval labels
+  vector<size_t> pfx;
+  // occ[id] = number of occurrences in buf
+  vector<size_t> occ;
+  vector<tuple<size_t, size_t, size_t, size_t>> S = {{0, no_id, 0, 0}};
+  for (size_t i = 1; i <= n; i++) {
+    const size_t h = i < n ? hgt[i] : 0;
+    size_t pos = sa[i - 1], last = no_id, lb = i - 1;
+    while (h < get<0>(S.back())) {
+      const auto [len, id, min_pos, id_lb] = S.back();
+      S.pop_back();
+      pos = min(pos, min_pos);
+      lb = id_lb;
+      occ[id] = i - lb;
+      id2pos[id] = pos;
+      if (last != no_id) pfx[last] = id;
+      last = id;
+    }
+    if (h > get<0>(S.back())) {
+      S.push_back({h, id2pos.size(), pos, lb});
+      id2pos.push_back(pos);
+      tab.push_back({h, {}});
+      pfx.push_back(no_id);
+      occ.push_back(0);
+    } else {
+      get<2>(S.back()) = min(get<2>(S.back()), pos);
+    }
+    if (last != no_id) pfx[last] = get<1>(S.back());
+    hgt_id[i] = get<1>(S.back());
+  }
+  // characters which are not lcp-interval labels themselves
+  array<size_t, 256> char_id;
+  char_id.fill(no_id);
+  for (size_t id = 0; id < tab.size(); id++) {
+    if (tab[id].first == 1) char_id[uint8_t(buf[id2pos[id]])] = id;
+  }
+  for (size_t pos = 0; pos < n; pos++) {
+    if (rk[pos] < m) continue;  // a separator
+    size_t &id = char_id[uint8_t(buf[pos])];
+    if (id != no_id) continue;
+    id = id2pos.size();
+    id2pos.push_back(pos);
+    tab.push_back({1, {}});
+    pfx.push_back(no_id);
+    occ.push_back(1);
+  }
+  fprintf(stderr, "tab.size() = %zu\n", tab.size());
+
+  // insert the documents to simplify the code
+  document_id = id2pos.size();
+  for (size_t k = 0; k < m; k++) {
+    id2pos.push_back(doc_pos[k]);
+    tab.push_back({doc_pos[k + 1] - 1 - doc_pos[k], {}});
+    pfx.push_back(no_id);
+  }
+
+  // pos2id[pos] = id of the longest label that buf[pos ...] starts with
+  vector<size_t> pos2id(n);
+  for (size_t pos = 0; pos < n; pos++) {
+    const size_t r = rk[pos];
+    const bool pick_r = r + 1 < n && hgt[r] < hgt[r + 1];
+    pos2id[pos] = hgt_id[pick_r ? r + 1 : r];
+  }
+
+  // tokenize ids into shorter ids at the least estimated cost.
+  // A character costs 1; a label costs about 1 per use plus its #define
+  // (13 + len / 5) shared by its occurrences.  Costs are in 1/1000 bytes.
+  using dp_tuple = tuple<size_t, size_t, size_t>;  // {cost, prev, id}
+  const auto tokenize = [&](const size_t id, vector<dp_tuple> &dp) {
+    auto &[len, subs] = tab[id];
+    if (len <= 1) return;
+    const size_t pos = id2pos[id];
+    dp.assign(len + 1, {no_id, 0, 0});
     dp[0] = {0, 0, 0};
     for (size_t j = 0; j < len; j++) {
-      auto matches = get_matches(id2pos(id) + j,
-                                 min<size_t>({len - 1, len - j, lookup_len}));
-      for (const auto &[match_hash, match_id, match_len] : matches) {
-        static_cast<void>(match_hash);
-        assert(j + match_len <= len);
-        dp[j + match_len] =
-            min(dp[j + match_len], {get<0>(dp[j]) + 1, j, match_id});
+      const size_t cost = get<0>(dp[j]);
+      const size_t c = char_id[uint8_t(buf[pos + j])];
+      dp[j + 1] = min(dp[j + 1], {cost + 1000, j, c});
+      for (size_t sub_id = pos2id[pos + j]; sub_id != no_id;
+           sub_id = pfx[sub_id]) {
+        const size_t sub_len = tab[sub_id].first;
+        if (sub_len >= len || j + sub_len > len) continue;
+        const size_t sub_cost = 1000 + (13000 + 200 * sub_len) / occ[sub_id];
+        dp[j + sub_len] = min(dp[j + sub_len], {cost + sub_cost, j, sub_id});
       }
     }
-    assert(get<0>(dp.back()) < buf_size);
+    assert(get<0>(dp.back()) != no_id);
     subs.clear();
     for (size_t j = len; j; j = get<1>(dp[j])) subs.push_back(get<2>(dp[j]));
     reverse(subs.begin(), subs.end());
+  };
+  // the documents are independent of each other, so they are tokenized in
+  // parallel
+  const size_t thread_cnt = clamp<size_t>(thread::hardware_concurrency(), 1, m);
+  {
+    vector<jthread> threads;
+    for (size_t t = 0; t < thread_cnt; t++) {
+      threads.emplace_back([&, t]() {
+        vector<dp_tuple> dp;
+        for (size_t k = t; k < m; k += thread_cnt) {
+          tokenize(document_id + k, dp);
+        }
+      });
+    }
+  }
+  // then the other ids, longest first, so that only the ids that the
+  // documents depend on are visited
+  vector<size_t> ids(document_id);
+  iota(ids.begin(), ids.end(), size_t(0));
+  stable_sort(ids.begin(), ids.end(), [](const size_t &id1, const size_t &id2) {
+    return tab[id1].first > tab[id2].first;
+  });
+  vector<bool> reachable(tab.size(), false);
+  for (size_t id = document_id; id < tab.size(); id++) {
+    for (const size_t &sub_id : tab[id].second) reachable[sub_id] = true;
+  }
+  vector<dp_tuple> dp;
+  for (const size_t &id : ids) {
+    if (!reachable[id]) continue;
+    tokenize(id, dp);
+    for (const size_t &sub_id : tab[id].second) reachable[sub_id] = true;
   }
 }
 
@@ -174,7 +416,6 @@ void get_sym() {
       for (size_t j = ord, k = sym_len; k--; j /= charset_size) {
         symbol += charset[j % charset_size];
       }
-      static const unordered_set<string> keywords = {"or", "and", "xor"};
       if (keywords.count(symbol)) {
         symbol.clear();
         skip++;
@@ -183,16 +424,19 @@ void get_sym() {
       }
     }
   }
+  // refcnt_sorted[_] = {id, refcnt}
   vector<pair<size_t, size_t>> refcnt_sorted;
   refcnt_sorted.reserve(refcnt.size());
-  copy(refcnt.begin(), refcnt.end(), back_inserter(refcnt_sorted));
+  for (size_t id = 0; id < refcnt.size(); id++) {
+    refcnt_sorted.emplace_back(id, refcnt[id]);
+  }
   sort(refcnt_sorted.begin(), refcnt_sorted.end(),
        [](const auto &p1, const auto &p2) {
          return p1.second > p2.second ||
                 (p1.second == p2.second && p1.first < p2.first);
        });
   assert(refcnt_sorted.size() <= sym_pool.size());
-  sym.clear();
+  sym.resize(refcnt.size());
   for (size_t i = 0; i < refcnt_sorted.size(); i++) {
     sym[refcnt_sorted[i].first] = sym_pool[i];
   }
@@ -203,17 +447,20 @@ array<string, 2> &get_def(const size_t);
 // ew: end with
 enum Choice : size_t { ew_quote = 0, ew_symbol = 1, symbol, unknown };
 using Iterable = vector<size_t>;
-array<pair<vector<Choice>, size_t>, 2> get_two_choices(const Iterable &subs) {
+// The definitions of subs must have been computed.
+const array<pair<vector<Choice>, size_t>, 2> &get_two_choices(
+    const Iterable &subs) {
   using dp_tuple = tuple<ptrdiff_t, Choice, Choice>;
-  // dp[ew_symbol?][pos] = {len, prev, choice}
-  vector<dp_tuple> dp[2];
-  dp[ew_quote].reserve(subs.size() + 1);
-  dp[ew_symbol].reserve(subs.size() + 1);
+  // dp[ew_symbol?][pos] = {len, prev, choice}, reused across calls
+  static vector<dp_tuple> dp[2];
+  dp[ew_quote].clear();
+  dp[ew_symbol].clear();
   dp[ew_quote].push_back({buf_size * 4, unknown, unknown});
   dp[ew_symbol].push_back({-1, unknown, unknown});
   for (const size_t &sub_id : subs) {
-    const ptrdiff_t ew_quote_len = get_def(sub_id)[ew_quote].length();
-    const ptrdiff_t ew_symbol_len = get_def(sub_id)[ew_symbol].length();
+    const array<string, 2> &sub_def = def[sub_id];
+    const ptrdiff_t ew_quote_len = sub_def[ew_quote].length();
+    const ptrdiff_t ew_symbol_len = sub_def[ew_symbol].length();
     const ptrdiff_t symbol_len = sym[sub_id].length();
 
     // if the number of invocations of the symbol is not large enough,
@@ -225,20 +472,20 @@ array<pair<vector<Choice>, size_t>, 2> get_two_choices(const Iterable &subs) {
 
     const Choice str0_choice = ew_quote;
     const Choice str1_choice =
-        dont_use_symbol || (get_def(sub_id)[ew_symbol] != null_ew_symbol &&
+        dont_use_symbol || (sub_def[ew_symbol] != null_ew_symbol &&
                             ew_symbol_len <= symbol_len)
             ? ew_symbol
             : symbol;
-    const string &str0 = get_def(sub_id)[ew_quote];
+    const string &str0 = sub_def[ew_quote];
     const string &str1 =
-        str1_choice == ew_symbol ? get_def(sub_id)[ew_symbol] : sym[sub_id];
+        str1_choice == ew_symbol ? sub_def[ew_symbol] : sym[sub_id];
     const ptrdiff_t str0_len = str0.length();
     const ptrdiff_t str1_len = str1.length();
     const ptrdiff_t str0_strip_len = str0_len - 3 * (str0.front() == '"');
     const ptrdiff_t str1_strip_len = str1_len - 3 * (str1.front() == '"');
 
-    const ptrdiff_t &p0_len = get<0>(dp[0].back());
-    const ptrdiff_t &p1_len = get<0>(dp[1].back());
+    const ptrdiff_t p0_len = get<0>(dp[0].back());
+    const ptrdiff_t p1_len = get<0>(dp[1].back());
 
     assert(str0.back() == '"' && str1.back() != '\"');
     dp[ew_quote].push_back(
@@ -250,7 +497,7 @@ array<pair<vector<Choice>, size_t>, 2> get_two_choices(const Iterable &subs) {
   }
   assert(subs.size() + 1 == dp[0].size() && subs.size() + 1 == dp[1].size());
 
-  decltype(get_two_choices(subs)) two_choices;
+  static remove_cvref_t<decltype(get_two_choices(subs))> two_choices;
   for (const Choice &ew : {ew_quote, ew_symbol}) {
     auto &[choices, len] = two_choices[ew];
     len = get<0>(dp[ew].back());
@@ -264,46 +511,79 @@ array<pair<vector<Choice>, size_t>, 2> get_two_choices(const Iterable &subs) {
   return two_choices;
 }
 
-string get_raw(const char *str, const size_t len) {
-  vector<size_t> escape;
-  for (size_t i = 0; i < len; i++) {
-    const char &ch = str[i];
-    if (ch == '\n' || ch == '\t' || ch == '"') escape.push_back(i);
+// esc_len[ch] = length of ch in a string literal. The other control
+// characters take 3 octal digits, so that a following digit never extends
+// the escape, even after adjacent literals are merged.
+constexpr array<size_t, 256> esc_len = []() {
+  array<size_t, 256> len;
+  for (int ch = 0; ch < 256; ch++) {
+    len[ch] = ch < 0x20 || ch == 0x7f ? 4 : ch == '"' || ch == '\\' ? 2 : 1;
+  }
+  len['\n'] = len['\t'] = len['\r'] = 2;
+  return len;
+}();
+
+// @return  the length of the longest prefix of str[0 ... len - 1] that needs
+// no escape, 16 bytes at a time with SSE2.
+size_t get_plain_len(const char *str, const size_t len) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i ctrl_max = _mm_set1_epi8(0x1f), quot = _mm_set1_epi8('"'),
+                bksl = _mm_set1_epi8('\\'), del = _mm_set1_epi8(0x7f);
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+    const __m128i esc = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max),
+                     _mm_cmpeq_epi8(v, quot)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, bksl), _mm_cmpeq_epi8(v, del)));
+    if (const int mask = _mm_movemask_epi8(esc)) return i + __builtin_ctz(mask);
   }
-  escape.push_back(len);
+#endif
+  while (i < len && esc_len[uint8_t(str[i])] == 1) i++;
+  return i;
+}
+
+// @return  str[0 ... len - 1] as a string literal, built in one pass.
+string get_raw(const char *str, const size_t len) {
   string raw;
-  raw.reserve(len + escape.size() + 2);
-  raw += "\"";
-  size_t pos = 0;
-  for (const auto &escape_pos : escape) {
-    raw.append(str + pos, str + escape_pos);
-    if (escape_pos >= len) break;
-    const char &ch = str[escape_pos];
+  raw.reserve(len + 2);
+  raw += '"';
+  for (size_t i = 0;; i++) {
+    const size_t plain_len = get_plain_len(str + i, len - i);
+    raw.append(str + i, plain_len);
+    if ((i += plain_len) == len) break;
+    const uint8_t ch = str[i];
+    raw += '\\';
     if (ch == '\n') {
-      raw += "\\n";
+      raw += 'n';
     } else if (ch == '\t') {
-      raw += "\\t";
-    } else if (ch == '"') {
-      raw += "\\\"";
+      raw += 't';
+    } else if (ch == '\r') {
+      raw += 'r';
+    } else if (esc_len[ch] == 2) {
+      raw += ch;
     } else {
-      assert(0);
+      raw += '0' + (ch >> 6);
+      raw += '0' + (ch >> 3 & 7);
+      raw += '0' + (ch & 7);
     }
-    pos = escape_pos + 1;
   }
-  raw += "\"";
+  raw += '"';
   return raw;
 }
 
 auto get_def(const size_t id) -> decltype((def[id])) {
-  if (def.count(id)) return def[id];
   auto &ret = def[id];
   const auto &[len, subs] = tab[id];
-  string raw = get_raw(buf + id2pos(id), len);
+  string raw = get_raw(buf + id2pos[id], len);
   if (subs.empty()) return ret = {move(raw), null_ew_symbol};
-  auto two_choices = get_two_choices(subs);
+  const auto &two_choices = get_two_choices(subs);
   for (const Choice &ew : {ew_quote, ew_symbol}) {
     const auto &[choices, len] = two_choices[ew];
     string &ret_ew = ret[ew];
+    ret_ew.clear();
+    ::ref[id][ew].clear();
     if (ew == ew_quote && len >= raw.length()) {
       ret_ew = move(raw);
       continue;
@@ -320,7 +600,7 @@ auto get_def(const size_t id) -> decltype((def[id])) {
       if (choice == ew_quote || choice == ew_symbol) {
         copy(::ref[sub_id][choice].begin(), ::ref[sub_id][choice].end(),
              back_inserter(::ref[id][ew]));
-        const string &str = get_def(sub_id)[choice];
+        const string &str = def[sub_id][choice];
         if (!ret_ew.empty() && ret_ew.back() == '"' && str.front() == '"') {
           ret_ew.pop_back();
           ret_ew += str.substr(1);
@@ -339,9 +619,35 @@ auto get_def(const size_t id) -> decltype((def[id])) {
   return ret;
 }
 
+void get_def_list() {
+  vector<size_t> ids(tab.size());
+  iota(ids.begin(), ids.end(), size_t(0));
+  stable_sort(ids.begin(), ids.end(), [](const size_t &id1, const size_t &id2) {
+    return tab[id1].first > tab[id2].first;
+  });
+  vector<bool> reachable(tab.size(), false);
+  fill(reachable.begin() + document_id, reachable.end(), true);
+  def_list.clear();
+  for (const size_t &id : ids) {
+    if (!reachable[id]) continue;
+    def_list.push_back(id);
+    for (const size_t &sub_id : tab[id].second) reachable[sub_id] = true;
+  }
+  reverse(def_list.begin(), def_list.end());
+}
+
+// Evaluates get_def bottom-up, so that it never recurses.
+void get_defs() {
+  for (const size_t &id : def_list) get_def(id);
+}
+
+// Only the definitions that are printed count, i.e. the documents and the
+// referenced ids. Longer ids come first, so refcnt[id] is final when visited.
 void get_refcnt() {
-  for (auto &[id, cnt] : refcnt) static_cast<void>(id), cnt = 0;
-  for (const size_t &id : id_list) {
+  fill(refcnt.begin(), refcnt.end(), 0);
+  for (auto it = def_list.rbegin(); it != def_list.rend(); it++) {
+    const size_t &id = *it;
+    if (id < document_id && refcnt[id] == 0) continue;
     const Choice ew =
         def[id][ew_quote].length() <= def[id][ew_symbol].length() ||
                 def[id][ew_symbol] == null_ew_symbol
@@ -351,28 +657,29 @@ void get_refcnt() {
   }
 }
 
-// @return  the length of document.
+// @return  the length of the output.
 size_t get_doc_len() {
   size_t ret = 0;
-  refcnt[document_id] = 1;
-  for (const size_t &id : id_list) {
-    if (refcnt[id] == 0) continue;
+  for (size_t id = 0; id < tab.size(); id++) {
+    if (id < document_id && refcnt[id] == 0) continue;
     const auto &[str_ew_quote, str_ew_symbol] = def[id];
     const string &str_define =
         str_ew_quote.length() <= str_ew_symbol.length() ||
                 str_ew_symbol == null_ew_symbol
             ? str_ew_quote
             : str_ew_symbol;
-    ret += str_define.length() + sym[id].length() + 10;
+    // "#define sym def\n" or "__asm__(def);\n"
+    ret += str_define.length();
+    ret += id < document_id ? sym[id].length() + 10 : 11;
   }
-  refcnt[document_id] = 0;
-  return ret - sym[document_id].length() + 1;
+  return ret;
 }
 
 void print_tab() {
-  for (const auto &p : tab) {
-    printf("id = %zu, len = %zu, tab = [ ", p.first, p.second.first);
-    for (const auto &ref_ref_id : p.second.second) {
+  for (size_t id = 0; id < tab.size(); id++) {
+    printf("id = %zu, pos = %zu, len = %zu, tab = [ ", id, id2pos[id],
+           tab[id].first);
+    for (const auto &ref_ref_id : tab[id].second) {
       printf("%zu ", ref_ref_id);
     }
     printf("]\n");
@@ -380,51 +687,119 @@ void print_tab() {
 }
 
 void print_def() {
-  for (const auto &p : def) {
-    printf("id%7zu:refcnt%4zu:len%3zu:%3s -> %s || %s\n", p.first,
-           refcnt[p.first], tab[p.first].first, sym[p.first].c_str(),
-           p.second[0].c_str(), p.second[1].c_str());
+  for (const size_t &id : def_list) {
+    printf("id%7zu:refcnt%4zu:len%3zu:%3s -> %s || %s\n", id, refcnt[id],
+           tab[id].first, sym[id].c_str(), def[id][0].c_str(),
+           def[id][1].c_str());
+  }
+}
+
+// @return  the documents without any #define, the output of last resort.
+string get_plain_pp() {
+  string out;
+  for (size_t k = 0; k + 1 < doc_pos.size(); k++) {
+    out += "__asm__(";
+    out += get_raw(buf + doc_pos[k], doc_pos[k + 1] - doc_pos[k] - 1);
+    out += ");\n";
   }
+  return out;
 }
 
-void print_pp() {
-  for (const auto &id : id_list) {
+string get_pp() {
+  string out;
+  out.reserve(get_doc_len());
+  for (size_t id = 0; id < document_id; id++) {
     if (refcnt[id] == 0) continue;
-    assert(id != document_id);
     const auto &[str_ew_quote, str_ew_symbol] = def[id];
     const string &str_define =
         str_ew_quote.length() <= str_ew_symbol.length() ||
                 str_ew_symbol == null_ew_symbol
             ? str_ew_quote
             : str_ew_symbol;
-    printf("#define %s %s\n", sym[id].c_str(), str_define.c_str());
+    out += "#define ";
+    out += sym[id];
+    out += ' ';
+    out += str_define;
+    out += '\n';
+  }
+  for (size_t id = document_id; id < tab.size(); id++) {
+    const string &document = def[id][ew_quote].length() <=
+                                     def[id][ew_symbol].length()
+                                 ? def[id][ew_quote]
+                                 : def[id][ew_symbol];
+    out += "__asm__(";
+    out += document;
+    out += ");\n";
   }
-  const string &document = def[document_id][ew_quote].length() <=
-                                   def[document_id][ew_symbol].length()
-                               ? def[document_id][ew_quote]
-                               : def[document_id][ew_symbol];
-  printf("__asm__(%s);\n", document.c_str());
+  assert(out.length() == get_doc_len());
+  return out;
 }
 
-int main() {
+// Usage: compress [--time-budget SECONDS] [--mem-budget MB] [input_file...]
+// Without input_file stdin is compressed to stdout.  Otherwise the files
+// share one dictionary: stdout gets the #defines once, followed by one
+// __asm__ document per input_file, in order.
+// The shortest output of an iteration is written. Under a budget,
+// refinement stops before an iteration that would overrun it, and the
+// output is the documents without any #define only if even the first
+// iteration does not fit. An output longer than those comes with a warning.
+int main(int argc, const char *argv[]) {
+  lap();
+  uptime();
+  vector<const char *> input_files(argv + 1, argv + argc);
+  get_budgets(input_files);
+  if (!input_files.empty()) {
+    read_inputs(input_files);
+  } else {
+    read_input(STDIN_FILENO);
+  }
   get_tab();
-  for (const auto &p : tab) {
-    refcnt[p.first]++;
-    for (const auto &sub_id : p.second.second) refcnt[sub_id]++;
+  get_def_list();
+  fprintf(stderr, "get_tab: %.3fs\n", lap());
+  refcnt.resize(tab.size());
+  def.resize(tab.size());
+  ::ref.resize(tab.size());
+  for (const auto &[len, subs] : tab) {
+    static_cast<void>(len);
+    for (const auto &sub_id : subs) refcnt[sub_id]++;
   }
+  for (size_t id = 0; id < tab.size(); id++) refcnt[id]++;
+  const bool budgeted = isfinite(time_budget) || isfinite(mem_budget);
+  // the shortest output of an iteration so far
+  string best_out;
+  double iter_time = 0;
   for (size_t i = 0, last_doc_len = 0; i < 20; i++) {
+    if (budgeted && over_budget(iter_time)) {
+      fprintf(stderr, "budget: stopped before iter #%zu\n", i);
+      break;
+    }
     get_sym();
-    def.clear();
-    ::ref.clear();
-    get_def(document_id);
+    const double sym_time = lap();
+    get_defs();
+    const double def_time = lap();
     get_refcnt();
     size_t doc_len = get_doc_len();
-    fprintf(stderr, "iter #%zu: doc_len = %zu\n", i, doc_len);
+    const double refcnt_time = lap();
+    fprintf(stderr,
+            "iter #%zu: doc_len = %zu (get_sym: %.3fs, get_defs: %.3fs, "
+            "get_refcnt: %.3fs)\n",
+            i, doc_len, sym_time, def_time, refcnt_time);
+    if (best_out.empty() || doc_len <= best_out.length()) best_out = get_pp();
+    iter_time = sym_time + def_time + refcnt_time + lap();
     if (doc_len == last_doc_len) break;
     last_doc_len = doc_len;
   }
 
-  print_pp();
+  const string plain_out = get_plain_pp();
+  if (best_out.empty()) {
+    best_out = plain_out;
+  } else if (best_out.length() > plain_out.length()) {
+    fprintf(stderr,
+            "Warning: the output is %zu bytes, more than the %zu bytes of the "
+            "documents without any #define.\n",
+            best_out.length(), plain_out.length());
+  }
+  write_output(STDOUT_FILENO, best_out.data(), best_out.length());
   // print_tab();
   // print_def();
 }
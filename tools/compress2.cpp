@@ -1,13 +1,37 @@
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <concepts>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 #include <numeric>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
+#include <thread>
 #include <variant>
 #include <vector>
+
+#include "keywords.h"
 using namespace std;
 
 using char_t = uint8_t;  // character type
@@ -24,7 +48,8 @@ constexpr len_t max_doc_len = 1 << 20;
 constexpr len_t len_inf = max_doc_len * 8;
 constexpr pen_t pen_prec = 1 << 20;  // penalty precision
 constexpr pen_t pen_inf = pen_prec * max_doc_len * 4;
-constexpr cnt_t max_dp_deep = 1;  // -1 for unlimited
+// prefixes tried per position by get_def: -1 for unlimited, --dp-depth
+cnt_t max_dp_deep = 1;
 
 constexpr hash_t hash_bias = 0x1234;
 constexpr hash_t hash_multi = 0x1000193u;
@@ -65,8 +90,8 @@ using choice_t = pair<id_t, swew_t>;  // choice type
 // length of document
 len_t doc_len;
 id_t id_size;
-// doc(ument) is the content of input_file
-vector<char_t> doc;
+// doc(ument) is the content of input_file, mapped read-only, plus a '\0'
+span<const char_t> doc;
 // suffix array, rank array, height array
 vector<pos_t> sa, rk;
 vector<len_t> hgt;
@@ -82,10 +107,22 @@ vector<hash_t> prefix_hash;
 vector<hash_t> hash_multi_pow;
 // prefixes: pfxs[id] = {id}
 vector<id_t> pfxs;
+// ids that get_def<len_t>(doc_id) depends on, in order of increasing length
+vector<id_t> ids;
+// levels of ids: ids[levels[l] ... levels[l + 1] - 1] have the same length
+vector<cnt_t> levels;
+// reverse dependencies: rdeps[rdep_pos[id] ... rdep_pos[id + 1] - 1] = ids
+// whose get_def<len_t> reads ldefs[id], lsymbs[id] and pens[id]
+vector<cnt_t> rdep_pos;
+vector<id_t> rdeps;
+// dirty[id] = whether get_def<len_t>(id) has to be re-evaluated
+vector<atomic<bool>> dirty;
 // substitutions: subs[id][SwEw] = {choice...}
 vector<array<vector<choice_t>, 4>> subs;
 // symbols: symbs[id] = symbol
 vector<reference_wrapper<str_t>::type> symbs;
+// length of symbols: lsymbs[id] = symbs[id].length()
+vector<len_t> lsymbs;
 // penalty of definitons: pens[id] = penalty
 vector<pen_t> pens;
 // length of definitons: ldefs[id][SwEw] = length
@@ -94,6 +131,11 @@ vector<array<len_t, 4>> ldefs;
 vector<array<str_t, 4>> defs;
 // reference counts: refcnts[id] = reference count
 vector<cnt_t> refcnts;
+// occurrences: occs[id] = number of occurrences in the document
+vector<cnt_t> occs;
+// expected uses: exp_uses[id] = number of references the definition of id
+// is shared by, starting from occs[id], then refcnts[id] while referenced
+vector<cnt_t> exp_uses;
 
 constexpr initializer_list<mem_t> global_memory = {
     1,                                    // others
@@ -108,58 +150,278 @@ constexpr initializer_list<mem_t> global_memory = {
 };
 
 constexpr initializer_list<mem_t> local_memory = {
-    sizeof(size_t) + 2,  // get_raw: escape, string
+    2,                   // get_raw: string
     1,                   // read_input:
     sizeof(size_t) * 2,  // get_sa: bucket, sa2
     sizeof(size_t),      // get_dict: prefix_hash
-    sizeof(size_t) * 5,  // get_pfxs: ufs, hgt_i, S
+    sizeof(size_t),      // get_pfxs: S
+};
+
+// Instrumentation: each Phase records its wall time, its allocation (the
+// heap in use at its end less that at its start), the resident set size at
+// its end and the peak resident set size of the process so far, which are
+// printed as "name: 1.234s (...)" and optionally written as a Chrome trace
+// (chrome://tracing, Perfetto). The heap is sampled by mallinfo2() when a
+// phase starts and ends, so memory allocated and freed within a phase only
+// shows in the peak resident set size. Building with -DHEAP_PEAK counts
+// every allocation instead, at the cost of an atomic update each, and adds
+// the peak heap of each phase.
+struct PhaseEvent {
+  const char *name;
+  int64_t start_us, dur_us;
+  int64_t alloc;
+  mem_t rss, peak_rss, heap_peak;
+};
+vector<PhaseEvent> phase_events;
+// heap bytes in use and the peak since the current phase started
+atomic<mem_t> heap_cur = 0, heap_peak = 0;
+// memory predicted by read_input, in bytes
+mem_t mem_estimate;
+// --time-budget and --mem-budget, unlimited by default
+int64_t time_budget_us = numeric_limits<int64_t>::max();
+mem_t mem_budget = numeric_limits<mem_t>::max();
+
+#ifdef HEAP_PEAK
+void *note_alloc(void *ptr) {
+  if (ptr == nullptr) throw bad_alloc();
+  const mem_t cur = heap_cur += malloc_usable_size(ptr);
+  for (mem_t peak = heap_peak; peak < cur;) {
+    if (heap_peak.compare_exchange_weak(peak, cur)) break;
+  }
+  return ptr;
+}
+
+// The array and nothrow forms call these in libstdc++, so they are counted
+// as well.
+void *operator new(size_t size) {
+  return note_alloc(malloc(max<size_t>(size, 1)));
+}
+
+void *operator new(size_t size, align_val_t align) {
+  const size_t a = size_t(align);
+  return note_alloc(aligned_alloc(a, (max<size_t>(size, 1) + a - 1) / a * a));
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr) return;
+  heap_cur -= malloc_usable_size(ptr);
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+void operator delete(void *ptr, align_val_t) noexcept { operator delete(ptr); }
+
+void operator delete(void *ptr, size_t, align_val_t) noexcept {
+  operator delete(ptr);
+}
+
+mem_t get_heap() { return heap_cur; }
+#else
+mem_t get_heap() {
+  const struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+#endif
+
+int64_t now_us() {
+  static const auto start = chrono::steady_clock::now();
+  return chrono::duration_cast<chrono::microseconds>(
+             chrono::steady_clock::now() - start)
+      .count();
+}
+
+// @return  resident set size in bytes.
+mem_t get_rss() {
+  FILE *file = fopen("/proc/self/statm", "r");
+  size_t pages = 0;
+  if (file != nullptr) {
+    if (fscanf(file, "%*s %zu", &pages) != 1) pages = 0;
+    fclose(file);
+  }
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+// @return  peak resident set size in bytes.
+mem_t get_peak_rss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return mem_t(usage.ru_maxrss) * 1024;
+}
+
+double to_mb(const double mem) { return mem / (1 << 20); }
+
+bool budgeted() {
+  return time_budget_us != numeric_limits<int64_t>::max() ||
+         mem_budget != numeric_limits<mem_t>::max();
+}
+
+// @return  whether --time-budget or --mem-budget has been overrun. Like in
+// compress, --mem-budget bounds the peak resident set size.
+bool over_budget() {
+  return now_us() > time_budget_us || get_peak_rss() > mem_budget;
+}
+
+// Removes "--time-budget SECONDS", "--mem-budget MB" and "--dp-depth N"
+// from args.
+void get_options(vector<const char *> &args) {
+  for (size_t i = 0; i < args.size();) {
+    const string_view arg = args[i];
+    if (arg != "--time-budget" && arg != "--mem-budget" &&
+        arg != "--dp-depth") {
+      i++;
+      continue;
+    }
+    char *end = nullptr;
+    const double value = i + 1 < args.size() ? strtod(args[i + 1], &end) : 0;
+    if (end == nullptr || end == args[i + 1] || *end || !(value > 0) ||
+        (arg == "--dp-depth" && value != cnt_t(value))) {
+      fprintf(stderr, "Error: %s expects a positive %s.\n", args[i],
+              arg == "--dp-depth" ? "integer" : "number");
+      exit(1);
+    }
+    if (arg == "--time-budget") {
+      time_budget_us = value * 1e6;
+    } else if (arg == "--mem-budget") {
+      mem_budget = value * (1 << 20);
+    } else {
+      max_dp_deep = value;
+    }
+    args.erase(args.begin() + i, args.begin() + i + 2);
+  }
+}
+
+// Times the enclosing scope. Phases are not nested.
+class Phase {
+ public:
+  explicit Phase(const char *const name)
+      : name(name), start_us(now_us()), heap_start(get_heap()) {
+    heap_peak = heap_start;
+  }
+  ~Phase() {
+    const mem_t heap = get_heap(), rss = get_rss();
+    heap_peak = max<mem_t>(heap_peak, heap);
+    // ru_maxrss lags behind the current resident set size
+    const PhaseEvent &event = phase_events.emplace_back(
+        name, start_us, now_us() - start_us,
+        int64_t(heap) - int64_t(heap_start), rss, max(rss, get_peak_rss()),
+        heap_peak.load());
+    fprintf(stderr, "%s: %.3fs (alloc = %+.1fMB, rss = %.1fMB", name,
+            event.dur_us * 1e-6, to_mb(event.alloc), to_mb(event.rss));
+#ifdef HEAP_PEAK
+    fprintf(stderr, ", heap_peak = %.1fMB", to_mb(event.heap_peak));
+#endif
+    fprintf(stderr, ", peak_rss = %.1fMB)\n", to_mb(event.peak_rss));
+  }
+
+ private:
+  const char *name;
+  int64_t start_us;
+  mem_t heap_start;
 };
 
+// Prints the total time, and the peak memory of the process next to the
+// additional memory estimated by read_input.
+void print_phases() {
+  int64_t total_us = 0;
+  mem_t peak_rss = get_peak_rss(), heap_peak_all = 0;
+  for (const PhaseEvent &event : phase_events) {
+    total_us += event.dur_us;
+    peak_rss = max(peak_rss, event.peak_rss);
+    heap_peak_all = max(heap_peak_all, event.heap_peak);
+  }
+  fprintf(stderr, "total: %.3fs (peak_rss = %.1fMB", total_us * 1e-6,
+          to_mb(peak_rss));
+#ifdef HEAP_PEAK
+  fprintf(stderr, ", heap_peak = %.1fMB", to_mb(heap_peak_all));
+#endif
+  fprintf(stderr, ", estimated = %.1fMB)\n", to_mb(mem_estimate));
+}
+
+void write_trace(const char *const trace_file) {
+  FILE *file = fopen(trace_file, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "Error: cannot write file '%s'\n", trace_file);
+    exit(1);
+  }
+  fprintf(file, "{\"traceEvents\": [\n");
+  for (size_t i = 0; i < phase_events.size(); i++) {
+    const auto &[name, start_us, dur_us, alloc, rss, peak_rss, heap_peak] =
+        phase_events[i];
+    fprintf(file,
+            "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, "
+            "\"ts\": %lld, \"dur\": %lld},\n",
+            name, (long long)start_us, (long long)dur_us);
+    fprintf(file,
+            "  {\"name\": \"memory\", \"ph\": \"C\", \"pid\": 0, "
+            "\"ts\": %lld, \"args\": {\"alloc_mb\": %.3f, "
+            "\"rss_mb\": %.3f, \"peak_rss_mb\": %.3f",
+            (long long)(start_us + dur_us), to_mb(alloc), to_mb(rss),
+            to_mb(peak_rss));
+#ifdef HEAP_PEAK
+    fprintf(file, ", \"heap_peak_mb\": %.3f", to_mb(heap_peak));
+#endif
+    fprintf(file, "}}%s\n", i + 1 < phase_events.size() ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+}
+
 template <typename T>
 concept StrOrLen = same_as<T, str_t> || same_as<T, len_t>;
 
+// Maps input_file in front of a zero page, so that the document is never
+// copied and doc[doc_len - 1] = '\0'.
 void read_input(const char *const input_file) {
-  FILE *file = fopen(input_file, "r");
-  if (file == nullptr) {
+  const int fd = open(input_file, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
     fprintf(stderr, "Error: cannot read file '%s'\n", input_file);
     exit(1);
   }
-  fseek(file, 0, SEEK_END);
-  doc_len = ftell(file) + 1;
-  if (doc_len > max_doc_len) {
+  if (st.st_size >= max_doc_len) {
     fprintf(stderr,
-            "Error: file_size = %d is larger than max_file_size = %d.\n",
-            doc_len, max_doc_len);
+            "Error: file_size = %lld is larger than max_file_size = %d.\n",
+            (long long)st.st_size, max_doc_len - 1);
     exit(2);
   }
-  doc.resize(doc_len);
-  fseek(file, 0, SEEK_SET);
-  assert(doc_len - 1 == len_t(fread(doc.data(), 1, doc_len - 1, file)));
-  assert(fgetc(file) == EOF);
-  fprintf(
-      stderr,
-      "file_size = %d. Up to %zuMB of additional memory will be used.\n",
-      doc_len - 1,
-      1 + (accumulate(global_memory.begin(), global_memory.end(), mem_t(0)) +
-           max(local_memory)) *
-              doc_len / (1 << 20));
+  doc_len = st.st_size + 1;
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t map_size = (doc_len + page_size - 1) / page_size * page_size;
+  void *addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+  if (addr != MAP_FAILED && doc_len > 1) {
+    addr = mmap(addr, doc_len - 1, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  }
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "Error: cannot map file '%s'\n", input_file);
+    exit(1);
+  }
+  close(fd);
+  doc = {static_cast<const char_t *>(addr), size_t(doc_len)};
+  mem_estimate =
+      (accumulate(global_memory.begin(), global_memory.end(), mem_t(0)) +
+       max(local_memory)) *
+      doc_len;
+  fprintf(stderr,
+          "file_size = %d. Up to %zuMB of additional memory will be used.\n",
+          doc_len - 1, 1 + mem_estimate / (1 << 20));
 }
 
+// The sentinel doc[doc_len - 1] ranks below every byte, which are ranked
+// by doc[pos] + 1, so the input may contain '\0' as well.
 void get_sa() {
-  if (count(doc.begin(), doc.end(), '\0') > 1) {
-    fprintf(stderr, "Input contains a null character '\\0'.\n");
-    exit(3);
-  }
-
   sa.resize(doc_len);
   rk.resize(doc_len);
   hgt.resize(doc_len);
 
-  len_t bucket_len = numeric_limits<decltype(doc)::value_type>::max() + 1;
+  len_t bucket_len = numeric_limits<decltype(doc)::value_type>::max() + 2;
   vector<cnt_t> bucket(max(doc_len, bucket_len), 0);
   vector<pos_t> sa2(doc_len);
 
-  for (pos_t pos = 0; pos < doc_len; pos++) bucket[rk[pos] = doc[pos]]++;
+  for (pos_t pos = 0; pos < doc_len; pos++) {
+    bucket[rk[pos] = pos + 1 < doc_len ? doc[pos] + 1 : 0]++;
+  }
   partial_sum(bucket.data(), bucket.data() + bucket_len, bucket.data());
   for (pos_t pos = doc_len; --pos;) sa[--bucket[rk[pos]]] = pos;
   for (len_t j = 1; j <= doc_len; j *= 2) {
@@ -172,12 +434,14 @@ void get_sa() {
     partial_sum(bucket.data(), bucket.data() + bucket_len, bucket.data());
     for (pos_t pos = doc_len; --pos;) sa[--bucket[rk[sa2[pos]]]] = sa2[pos];
     swap(rk, sa2);
-    auto last_sa = sa[0];
     cnt = 0;
-    for (pos_t pos = 0; pos < doc_len; pos++) {
-      cnt +=
-          sa2[last_sa] != sa2[sa[pos]] || sa2[last_sa + j] != sa2[sa[pos] + j];
-      rk[last_sa = sa[pos]] = cnt;
+    rk[sa[0]] = 0;
+    for (pos_t pos = 1; pos < doc_len; pos++) {
+      // the unique sentinel keeps sa[_] + j in range when the first halves
+      // match
+      cnt += sa2[sa[pos - 1]] != sa2[sa[pos]] ||
+             sa2[sa[pos - 1] + j] != sa2[sa[pos] + j];
+      rk[sa[pos]] = cnt;
     }
     bucket_len = cnt + 1;
     if (bucket_len == doc_len) break;
@@ -188,7 +452,8 @@ void get_sa() {
   for (pos_t pos = 0, k = 0; pos < doc_len - 1; pos++) {
     if (k) k--;
     size_t j = sa[rk[pos] - 1];
-    while (doc[pos + k] == doc[j + k]) k++;
+    const pos_t end = doc_len - 1 - max<pos_t>(pos, j);
+    while (k < end && doc[pos + k] == doc[j + k]) k++;
     hgt[rk[pos]] = k;
   }
 }
@@ -236,48 +501,31 @@ void get_dict() {
   id_size = addrs.size();
 }
 
+// pfxs[id] = the longer one of the lcp-intervals around the one labeled by
+// id, i.e. the label of the nearest smaller hgt on the left or the right.
+// A monotone stack finds both: when i pops j, hgt[i] is the nearest smaller
+// on the right, and the new top (after equal heights, which label the same
+// lcp-interval) is the nearest smaller on the left.
+// time: O(doc_len)
 void get_pfxs() {
-  struct UFS {
-    vector<pos_t> lf, rf;
-    UFS(len_t n) : lf(n), rf(n) {
-      iota(lf.begin(), lf.end(), pos_t(0));
-      iota(rf.begin(), rf.end(), pos_t(0));
-    }
-    pos_t get_l(pos_t x) { return x == lf[x] ? x : lf[x] = get_l(lf[x]); }
-    pos_t get_r(pos_t x) { return x == rf[x] ? x : rf[x] = get_r(rf[x]); }
-    void merge(pos_t x, pos_t y) {
-      x = get_l(x), y = get_l(y);
-      if (x == y) return;
-      x < y ? lf[y] = x : lf[x] = y;
-      x = get_r(x), y = get_r(y);
-      assert(x != y);
-      x < y ? rf[x] = y : rf[y] = x;
-    }
-  };
-  UFS ufs(doc_len);
-  vector<pair<len_t, pos_t>> hgt_i(doc_len);
   assert(len_t(hgt.size()) == doc_len);
-  for (pos_t i = 0; i < doc_len; i++) hgt_i[i] = {hgt[i], i};
-  ranges::sort(hgt_i, greater<>{});
   pfxs.resize(id_size, empty_id);
-  len_t last_h = hgt_i.front().first;
-  vector<pos_t> S;
-  for (auto [h, i] : hgt_i) {
-    if (last_h != h) {
-      last_h = h;
-      for (auto j : S) {
-        pos_t l = ufs.get_l(j), r = ufs.get_r(j);
-        assert(l == 0 || hgt[l - 1] < hgt[j]);
-        assert(r + 1 == doc_len || hgt[r + 1] < hgt[j]);
-        const bool pick_r =
-            l == 0 || (r + 1 < doc_len && hgt[l - 1] < hgt[r + 1]);
-        pfxs[pos2id[sa[j]]] = pos2id[sa[pick_r ? r + 1 : l - 1]];
-      }
-      S.clear();
+  occs.assign(id_size, 1);
+  vector<pos_t> S;  // indices of non-decreasing hgt
+  S.reserve(doc_len);
+  for (pos_t i = 0; i <= doc_len; i++) {
+    const len_t h = i < doc_len ? hgt[i] : -1;
+    while (!S.empty() && hgt[S.back()] > h) {
+      const pos_t j = S.back();
+      S.pop_back();
+      if (!S.empty() && hgt[S.back()] == hgt[j]) continue;
+      const bool has_l = !S.empty(), has_r = i < doc_len;
+      if (!has_l && !has_r) continue;
+      occs[pos2id[sa[j]]] = i - (has_l ? S.back() : 0);
+      const bool pick_r = !has_l || (has_r && hgt[S.back()] < hgt[i]);
+      pfxs[pos2id[sa[j]]] = pos2id[sa[pick_r ? i : S.back()]];
     }
     S.push_back(i);
-    if (i > 0 && hgt[i - 1] >= h) ufs.merge(i, i - 1);
-    if (++i < doc_len && hgt[i] >= h) ufs.merge(i, i - 1);
   }
   if (doc_id != pos2id[0]) pfxs[doc_id] = pos2id[0];
   for (id_t id = 0; id < id_size; id++) {
@@ -294,6 +542,12 @@ void get_pfxs() {
   }
 }
 
+void mark_rdeps(const id_t id) {
+  for (cnt_t k = rdep_pos[id]; k < rdep_pos[id + 1]; k++) {
+    dirty[rdeps[k]].store(true, memory_order_relaxed);
+  }
+}
+
 void get_symbs() {
   static vector<str_t *> symb_pool;
   if (symb_pool.size() < id_size) {
@@ -318,7 +572,6 @@ void get_symbs() {
       for (cnt_t j = seq, k = 0; k < symb_len; j /= charset_size, k++) {
         symb[k] = charset[j % charset_size];
       }
-      static const unordered_set<str_t> keywords = {"or", "and", "xor"};
       if (keywords.count(symb)) {
         skip++;
         seq++;
@@ -334,45 +587,90 @@ void get_symbs() {
     return make_pair(-refcnts[id1], id1) < make_pair(-refcnts[id2], id2);
   });
   symbs.resize(id_size);
-  for (id_t id = 0; id < id_size; id++) {
-    symbs[refcnts_id[id]] = *symb_pool[id];
+  lsymbs.resize(id_size);
+  for (id_t k = 0; k < id_size; k++) {
+    const id_t id = refcnts_id[k];
+    symbs[id] = *symb_pool[k];
+    if (lsymbs[id] == len_t(symb_pool[k]->length())) continue;
+    lsymbs[id] = symb_pool[k]->length();
+    mark_rdeps(id);
   }
 }
 
+// esc_lens[ch] = length of ch in a string literal. The other control
+// characters take 3 octal digits, so that a following digit never extends
+// the escape, even after adjacent literals are merged.
+constexpr array<len_t, 256> esc_lens = []() {
+  array<len_t, 256> lens;
+  for (int ch = 0; ch < 256; ch++) {
+    lens[ch] = ch < 0x20 || ch == 0x7f ? 4 : ch == '"' || ch == '\\' ? 2 : 1;
+  }
+  lens['\n'] = lens['\t'] = lens['\r'] = 2;
+  return lens;
+}();
+
+// @return  the length of the longest prefix of str[0 ... len - 1] that needs
+// no escape, 16 bytes at a time with SSE2.
+len_t get_plain_len(const char_t *str, const len_t len) {
+  len_t i = 0;
+#ifdef __SSE2__
+  const __m128i ctrl_max = _mm_set1_epi8(0x1f), quot = _mm_set1_epi8('"'),
+                bksl = _mm_set1_epi8('\\'), del = _mm_set1_epi8(0x7f);
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+    const __m128i esc = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max),
+                     _mm_cmpeq_epi8(v, quot)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, bksl), _mm_cmpeq_epi8(v, del)));
+    if (const int mask = _mm_movemask_epi8(esc)) return i + __builtin_ctz(mask);
+  }
+#endif
+  while (i < len && esc_lens[str[i]] == 1) i++;
+  return i;
+}
+
+// Appends str[0 ... len - 1] to out, escaping what esc_lens says.
+void put_escaped(str_t &out, const char_t *str, const len_t len) {
+  for (len_t i = 0;; i++) {
+    const len_t plain_len = get_plain_len(str + i, len - i);
+    out.append(reinterpret_cast<const char *>(str + i), plain_len);
+    if ((i += plain_len) == len) break;
+    const char_t ch = str[i];
+    out += '\\';
+    if (ch == '\n') {
+      out += 'n';
+    } else if (ch == '\t') {
+      out += 't';
+    } else if (ch == '\r') {
+      out += 'r';
+    } else if (esc_lens[ch] == 2) {
+      out += ch;
+    } else {
+      out += '0' + (ch >> 6);
+      out += '0' + (ch >> 3 & 7);
+      out += '0' + (ch & 7);
+    }
+  }
+}
+
+// @return  the length of str[0 ... len - 1] as a string literal, without
+// allocation.
 template <StrOrLen T>
 T get_raw(const char_t *str, const len_t len) {
-  vector<pos_t> escape;
-  for (pos_t i = 0; i < len; i++) {
-    const char_t &ch = str[i];
-    if (ch == '\n' || ch == '\t' || ch == '"') escape.push_back(i);
+  len_t raw_len = len + 2;
+  for (len_t i = 0;; i++) {
+    if ((i += get_plain_len(str + i, len - i)) == len) break;
+    raw_len += esc_lens[str[i]] - 1;
   }
-  const len_t raw_len = len /*+ escape.size()*/ + 2;
   if constexpr (same_as<T, len_t>) {
     return raw_len;
   } else {
     str_t raw;
-    raw.reserve(len + escape.size() + 2);
-    raw += "\"";
-    escape.push_back(len);
-    pos_t pos = 0;
-    for (const auto &escape_pos : escape) {
-      raw.append(str + pos, str + escape_pos);
-      if (escape_pos >= len) break;
-      const char_t &ch = str[escape_pos];
-      if (ch == '\n') {
-        // raw += "\\n";
-        raw += '^';
-      } else if (ch == '\t') {
-        raw += "\\t";
-      } else if (ch == '"') {
-        // raw += "\\\"";
-        raw += '"';
-      } else {
-        assert(0);
-      }
-      pos = escape_pos + 1;
-    }
-    raw += "\"";
+    raw.reserve(raw_len);
+    raw += '"';
+    put_escaped(raw, str, len);
+    raw += '"';
     assert(len_t(raw.length()) == raw_len);
     return raw;
   }
@@ -478,96 +776,324 @@ continue; set_min( dp[i + plen][j], dp_info{dp[i][prev].pen + pens[pid],
     pens[id] = pen_prec * ranges::min(def) / max<ptrdiff_t>(1, refcnts[id]);
   return def;
 }*/
-size_t retry_cnt = 0, dp_cnt = 0, backtrace_cnt = 0;
+atomic<size_t> retry_cnt = 0, dp_cnt = 0, backtrace_cnt = 0, eval_cnt = 0;
+
+// Calls f(i, pid) for each piece pid that the definition of id may place at
+// offset i. Every piece is strictly shorter than id.
+// @return  the number of retries.
+template <typename F>
+size_t for_each_piece(const id_t id, F &&f) {
+  size_t retries = 0;
+  const auto &[pos, len] = addrs[id];
+  for (len_t i = 0; i < len; i++) {
+    assert(pos + i < doc_len);
+    id_t pid = i == 0 ? pfxs[id] : pos2id[pos + i];
+    for (cnt_t d = max_dp_deep; d-- && pid != empty_id; pid = pfxs[pid]) {
+      while (i + addrs[pid].second > len) {
+        pid = pfxs[pid];
+        retries++;
+      }
+      f(i, pid);
+    }
+  }
+  return retries;
+}
+
+void get_ids() {
+  // counting sort by length in decreasing order
+  vector<cnt_t> bucket(doc_len + 1, 0);
+  for (id_t id = 0; id < id_size; id++) bucket[addrs[id].second]++;
+  partial_sum(bucket.rbegin(), bucket.rend(), bucket.rbegin());
+  vector<id_t> ids_desc(id_size);
+  for (id_t id = id_size; id--;) ids_desc[--bucket[addrs[id].second]] = id;
+  vector<bool> reachable(id_size, false);
+  reachable[doc_id] = true;
+  ids.clear();
+  for (const id_t &id : ids_desc) {
+    if (!reachable[id]) continue;
+    ids.push_back(id);
+    if (pfxs[id] == empty_id) continue;
+    for_each_piece(id, [&](len_t, id_t pid) { reachable[pid] = true; });
+  }
+  ranges::reverse(ids);
+  levels.clear();
+  for (cnt_t k = 0; k < cnt_t(ids.size()); k++) {
+    if (k == 0 || addrs[ids[k]].second != addrs[ids[k - 1]].second) {
+      levels.push_back(k);
+    }
+  }
+  levels.push_back(ids.size());
+
+  // counts, then fills the distinct pieces of each id into rdeps
+  rdep_pos.assign(id_size + 1, 0);
+  vector<id_t> last(id_size, empty_id);
+  const auto for_each_dep = [&](auto &&f) {
+    for (const id_t &id : ids) {
+      if (pfxs[id] == empty_id) continue;
+      for_each_piece(id, [&](len_t, id_t pid) {
+        if (last[pid] != id) f(id, pid);
+        last[pid] = id;
+      });
+    }
+  };
+  for_each_dep([](id_t, id_t pid) { rdep_pos[pid + 1]++; });
+  partial_sum(rdep_pos.begin(), rdep_pos.end(), rdep_pos.begin());
+  rdeps.resize(rdep_pos.back());
+  ranges::fill(last, empty_id);
+  vector<cnt_t> fill_pos(rdep_pos.begin(), rdep_pos.end() - 1);
+  for_each_dep([&](id_t id, id_t pid) { rdeps[fill_pos[pid]++] = id; });
+  dirty = vector<atomic<bool>>(id_size);
+  for (atomic<bool> &d : dirty) d = true;
+}
+
+// The cost model of a symbol: its #define line shared by its expected
+// uses, in units of 1 / pen_prec characters. Charging the whole line to a
+// symbol which is not referenced yet would keep it unreferenced for good.
+pen_t get_pen(const id_t id) {
+  const len_t line_len = 10 + lsymbs[id] + ranges::min(ldefs[id]);
+  return pen_prec * line_len / max<cnt_t>(1, exp_uses[id]);
+}
+
 template <>
 array<len_t, 4> &get_def(const id_t id) {
   assert(id < id_size);
   auto &def = ldefs[id];
 
-  if (def[swew_t::sw_quot | swew_t::ew_quot]) return def;
   const auto &[pos, len] = addrs[id];
   if (pfxs[id] == empty_id) {
     def = {get_raw<len_t>(doc.data() + pos, len), len_inf, len_inf, len_inf};
   } else {
-    // using dp_idx_t = pair<pos_t, swew_t>;  // dp index type
-    struct dp_info {
-      pen_t pen;
-      len_t len;
-      const dp_info *prev;
-      choice_t choice;
-      bool operator<(const dp_info &t) const {
-        return pen + len * pen_prec < t.pen + t.len * pen_prec;
-      }
-    };
-    constexpr dp_info dp_init = {pen_inf,
-                                 len_inf,
-                                 /*{0, swew_t::unknown}*/ nullptr,
-                                 {empty_id, swew_t::unknown}};
-    // dp[pos][swew] = dp_info
-    vector<array<dp_info, 4>> dp(len + 1, {dp_init, dp_init, dp_init, dp_init});
-    for (const swew_t &j : swew_t::all) {
-      dp[0][j].pen = 0;
-      dp[0][j].len = array<len_t, 4>{2, 2, 2, -1}[j];
-    }
+    // score = penalty + length * pen_prec
+    constexpr pen_t score_inf = pen_inf + len_inf * pen_prec;
+    constexpr array<len_t, 4> init_len = {2, 2, 2, -1};
+    // back = pid << 5 | choice << 2 | prev, the position of prev is implied
+    // by the length of pid
+    using back_t = uint32_t;
+    constexpr back_t back_none = numeric_limits<back_t>::max();
+    static_assert(2 * max_doc_len + 2 < (1 << 27));
+    // dp[pos][swew] = score, bk[pos][swew] = back, reused across calls of
+    // the same thread
+    thread_local vector<array<pen_t, 4>> dp;
+    thread_local vector<array<back_t, 4>> bk;
+    dp.assign(len + 1, {score_inf, score_inf, score_inf, score_inf});
+    bk.assign(len + 1, {back_none, back_none, back_none, back_none});
+    for (const swew_t &j : swew_t::all) dp[0][j] = init_len[j] * pen_prec;
 
-    for (len_t i = 0; i < len; i++) {
-      assert(pos + i < doc_len);
-      id_t pid = i == 0 ? pfxs[id] : pos2id[pos + i];
-      for (cnt_t d = max_dp_deep; d-- && pid != empty_id; pid = pfxs[pid]) {
-      retry:
-        const auto &[ppos, plen] = addrs[pid];
-        // assert(i + plen <= len);
-        if (i + plen > len) {
-          pid = pfxs[pid];
-          retry_cnt++;
-          goto retry;
-        }
-        const auto &pdef = get_def<len_t>(pid);
-        for (const swew_t &j : swew_t::all) {
-          for (const swew_t &k : swew_t::all) {
-            dp_cnt++;
-            const swew_t prev = j.sw() | k.ew(), choice = k.sw() | j.ew();
-            const auto &dp_prev = dp[i][prev];
-            set_min(dp[i + plen][j],
-                    dp_info{dp_prev.pen,
-                            dp_prev.len +
-                                (k == (swew_t::sw_quot | swew_t::ew_quot) ? -2
-                                                                          : 1) +
-                                pdef[choice],
-                            &dp_prev,
-                            {pid, choice}});
-            if (j.ew() != swew_t::ew_symb) continue;
-            set_min(dp[i + plen][j],
-                    dp_info{dp_prev.pen + pens[pid],
-                            dp_prev.len + 1 + len_t(symbs[pid].length()),
-                            &dp_prev,
-                            {pid, swew_t::uz_symb}});
+    size_t dps = 0, backtraces = 0;
+    retry_cnt += for_each_piece(id, [&](const len_t i, const id_t pid) {
+      const len_t plen = addrs[pid].second;
+      const auto &pdef = ldefs[pid];
+      assert(pdef[swew_t::sw_quot | swew_t::ew_quot]);
+      const pen_t symb_score = (1 + lsymbs[pid]) * pen_prec + pens[pid];
+      auto &dp_next = dp[i + plen];
+      auto &bk_next = bk[i + plen];
+      for (const swew_t &j : swew_t::all) {
+        for (const swew_t &k : swew_t::all) {
+          dps++;
+          const swew_t prev = j.sw() | k.ew(), choice = k.sw() | j.ew();
+          const pen_t score =
+              dp[i][prev] +
+              ((k == (swew_t::sw_quot | swew_t::ew_quot) ? -2 : 1) +
+               pdef[choice]) *
+                  pen_prec;
+          if (score < dp_next[j]) {
+            dp_next[j] = score;
+            bk_next[j] = pid << 5 | choice << 2 | prev;
+          }
+          if (j.ew() != swew_t::ew_symb) continue;
+          if (dp[i][prev] + symb_score < dp_next[j]) {
+            dp_next[j] = dp[i][prev] + symb_score;
+            bk_next[j] = pid << 5 | swew_t::uz_symb << 2 | prev;
           }
         }
       }
-    }
-    // backtrace
+    });
+    // backtrace, recovering the length of definitions on the way
     for (const swew_t &swew : swew_t::all) {
-      def[swew] = dp[len][swew].len;
       auto &sub = subs[id][swew];
-      for (const dp_info *p = &dp[len][swew]; p->prev; p = p->prev) {
-        backtrace_cnt++;
-        sub.push_back(p->choice);
+      sub.clear();
+      len_t i = len, def_len = 0;
+      swew_t state = swew;
+      for (; i > 0 && bk[i][state] != back_none; backtraces++) {
+        const back_t back = bk[i][state];
+        const id_t pid = back >> 5;
+        const swew_t choice = back >> 2 & 7, prev = back & 3;
+        if (choice == swew_t::uz_symb) {
+          def_len += 1 + lsymbs[pid];
+        } else {
+          const bool merge = (choice.sw() | prev.ew()) ==
+                             (swew_t::sw_quot | swew_t::ew_quot);
+          def_len += (merge ? -2 : 1) + ldefs[pid][choice];
+        }
+        sub.push_back({pid, choice});
+        i -= addrs[pid].second;
+        state = prev;
+      }
+      if (i > 0) {
+        sub.clear();
+        def[swew] = len_inf;
+      } else {
+        def[swew] = def_len + init_len[state];
       }
+      ranges::reverse(sub);
     }
+    dp_cnt += dps;
+    backtrace_cnt += backtraces;
   }
-  pens[id] = pen_prec * ranges::min(def) / max<cnt_t>(1, refcnts[id]);
+  pens[id] = get_pen(id);
   return def;
 }
 
-void get_refcnts() {
+// Re-evaluates get_def<len_t>(id) only if something it reads has changed,
+// and propagates a change of id to the ids that read it.
+void update_def(const id_t id) {
+  const array<len_t, 4> last_def = ldefs[id];
+  const pen_t last_pen = pens[id];
+  if (dirty[id].exchange(false, memory_order_relaxed)) {
+    get_def<len_t>(id);
+    eval_cnt++;
+  } else {
+    pens[id] = get_pen(id);
+  }
+  if (ldefs[id] != last_def || pens[id] != last_pen) mark_rdeps(id);
+}
+
+// Evaluates get_def<len_t> bottom-up, level by level. The ids of one level
+// only depend on shorter ids, so each level is shared among the threads, and
+// the barrier publishes the dirty marks for the longer ids.
+// @return  false if a budget was overrun, leaving the evaluation incomplete.
+bool get_defs() {
+  static const cnt_t thread_cnt = max(1u, thread::hardware_concurrency());
+  constexpr cnt_t chunk = 64;
+  size_t level = 0;
+  atomic<cnt_t> next = 0;
+  bool stopped = false;
+  barrier sync(thread_cnt, [&]() noexcept {
+    level++, next = 0;
+    if (level + 1 < levels.size() && budgeted() && over_budget()) {
+      level = levels.size(), stopped = true;
+    }
+  });
+  const auto worker = [&]() {
+    while (level + 1 < levels.size()) {
+      const cnt_t lb = levels[level], le = levels[level + 1];
+      for (cnt_t k; (k = lb + next.fetch_add(chunk)) < le;) {
+        for (const cnt_t e = min(k + chunk, le); k < e; k++) {
+          update_def(ids[k]);
+        }
+      }
+      sync.arrive_and_wait();
+    }
+  };
+  vector<jthread> threads;
+  for (cnt_t t = 1; t < thread_cnt; t++) threads.emplace_back(worker);
+  worker();
+  return !stopped;
+}
+
+swew_t best_swew(const id_t id) {
+  return ranges::min_element(ldefs[id]) - ldefs[id].begin();
+}
+
+// refcnts[id] = number of times symbs[id] appears in the output
+// @return  whether exp_uses has changed, short of which the next iteration
+// would find the same definitions.
+bool get_refcnts() {
+  // uses[id][swew] = number of times defs[id][swew] is inlined in the output
+  vector<array<cnt_t, 4>> uses(id_size, {0, 0, 0, 0});
   ranges::fill(refcnts, 0);
+  uses[doc_id][best_swew(doc_id)] = 1;
+  for (const id_t &id : ids | views::reverse) {
+    if (id != doc_id && refcnts[id] > 0) uses[id][best_swew(id)]++;
+    for (const swew_t &swew : swew_t::all) {
+      if (uses[id][swew] == 0) continue;
+      for (const auto &[pid, choice] : subs[id][swew]) {
+        if (choice == swew_t::uz_symb) {
+          refcnts[pid] += uses[id][swew];
+        } else {
+          uses[pid][choice] += uses[id][swew];
+        }
+      }
+    }
+  }
+  // An unreferenced symbol keeps a quarter of its expected uses, so it is
+  // not priced out at once, and reaches 0 within a few iterations; a
+  // referenced one takes its refcount undamped. Damping both kept the
+  // penalties of almost every id changing, so nothing converged.
+  bool changed = false;
   for (id_t id = 0; id < id_size; id++) {
-    ranges::min_element(ldefs[id]);
+    const cnt_t uses = refcnts[id] ? refcnts[id] : exp_uses[id] / 4;
+    changed |= uses != exp_uses[id];
+    exp_uses[id] = uses;
   }
+  return changed;
 }
 
-size_t get_output_len() { return 0; }
+// @return  the length of output.
+size_t get_output_len() {
+  size_t ret = 0;
+  for (id_t id = 0; id < id_size; id++) {
+    if (id == doc_id || refcnts[id] == 0) continue;
+    // "#define " symb " " def "\n"
+    ret += 10 + lsymbs[id] + ranges::min(ldefs[id]);
+  }
+  // "__asm__(" def ");\n"
+  return ret + 11 + ranges::min(ldefs[doc_id]);
+}
+
+// Appends the definition of id in state swew to out. Pieces are joined the
+// way get_def<len_t> priced them: adjacent quotes merge, otherwise a space.
+void put_def(str_t &out, const id_t id, const swew_t swew) {
+  struct frame_t {
+    id_t id;
+    swew_t swew;
+    cnt_t i;
+  };
+  static vector<frame_t> S;
+  // ew_symb: the output ends with a symbol rather than a quote
+  // merge: the next opening quote replaces the closing quote of the output
+  bool ew_symb = false, merge = false;
+  const auto put_quot = [&]() {
+    merge ? out.pop_back() : out.push_back('"');
+    merge = false;
+  };
+  S.push_back({id, swew, 0});
+  while (!S.empty()) {
+    auto &[id, swew, i] = S.back();
+    if (pfxs[id] == empty_id) {
+      assert(swew == (swew_t::sw_quot | swew_t::ew_quot));
+      const auto &[pos, len] = addrs[id];
+      put_quot();
+      put_escaped(out, doc.data() + pos, len);
+      out += '"';
+      ew_symb = false;
+      S.pop_back();
+      continue;
+    }
+    const auto &sub = subs[id][swew];
+    if (i == cnt_t(sub.size())) {
+      S.pop_back();
+      continue;
+    }
+    const auto [pid, choice] = sub[i++];
+    const bool uz_symb = choice == swew_t::uz_symb;
+    const bool sw_symb = uz_symb || choice.sw();
+    if (i == 1) {
+      if (sw_symb && !swew.sw()) put_quot(), out += "\" ";
+    } else if (!sw_symb && !ew_symb) {
+      merge = true;
+    } else {
+      out += ' ';
+    }
+    if (uz_symb) {
+      out += symbs[pid];
+      ew_symb = true;
+    } else {
+      S.push_back({pid, choice, 0});
+    }
+  }
+  assert(!merge);
+}
 
 void print_hgt() {
   for (pos_t i = 0; i < doc_len; i++) {
@@ -585,48 +1111,164 @@ void print_hgt() {
   }
 }
 
-void write_output(const char *const output_file) {
-  FILE *file = fopen(output_file, "w");
-  if (file == nullptr) {
+// @return  the document without any #define, the output of last resort.
+str_t get_plain_output() {
+  str_t out = "__asm__(\"";
+  put_escaped(out, doc.data(), doc_len - 1);
+  return out += "\");\n";
+}
+
+str_t get_output() {
+  str_t out;
+  out.reserve(get_output_len());
+  for (id_t id = 0; id < id_size; id++) {
+    if (id == doc_id || refcnts[id] == 0) continue;
+    out += "#define ";
+    out += symbs[id];
+    out += ' ';
+    const size_t def_pos = out.length();
+    put_def(out, id, best_swew(id));
+    assert(out.length() - def_pos == size_t(ranges::min(ldefs[id])));
+    out += '\n';
+  }
+  out += "__asm__(";
+  const size_t doc_pos = out.length();
+  put_def(out, doc_id, best_swew(doc_id));
+  assert(out.length() - doc_pos == size_t(ranges::min(ldefs[doc_id])));
+  out += ");\n";
+  assert(out.length() == get_output_len());
+  return out;
+}
+
+void write_output(const char *const output_file, const str_t &out) {
+  const int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
     fprintf(stderr, "Error: cannot write file '%s'\n", output_file);
     exit(1);
   }
-  fputs("// " __FILE__ " " __DATE__ " " __TIME__, file);
+  // a single write() unless it is short
+  for (size_t pos = 0; pos < out.length();) {
+    const ssize_t ret = write(fd, out.data() + pos, out.length() - pos);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret == -1) {
+      fprintf(stderr, "Error: cannot write file '%s'\n", output_file);
+      exit(1);
+    }
+    pos += ret;
+  }
+  close(fd);
 }
 
+// Usage: compress2 [--time-budget SECONDS] [--mem-budget MB] [--dp-depth N]
+//            input_file output_file [trace_file]
+// --dp-depth is the number of nested prefixes get_def tries at each
+// position, 1 by default; more find shorter output, slower.
+// The shortest output of a complete iteration is written. Under a budget,
+// refinement stops as soon as it is overrun, and the output is the document
+// without any #define only if even the first iteration does not complete.
+// An output longer than that document comes with a warning.
 int main(int argc, const char *argv[]) {
+  now_us();
+  vector<const char *> args(argv, argv + argc);
+  get_options(args);
   str_t input_file, output_file;
-  if (argc > 1) {
-    input_file = argv[1];
+  if (args.size() > 1) {
+    input_file = args[1];
   } else {
     cout << "input_file: " << endl;
     cin >> input_file;
   }
-  if (argc > 2) {
-    output_file = argv[2];
+  if (args.size() > 2) {
+    output_file = args[2];
   } else {
     cout << "output_file: " << endl;
     cin >> output_file;
   }
-  read_input(input_file.c_str());
-  get_sa();
-  get_dict();
-  get_pfxs();
-  print_hgt();
-  fflush(stdout);
+  {
+    Phase phase("read_input");
+    read_input(input_file.c_str());
+  }
+  // there is no dictionary to build for an empty document
+  if (doc_len == 1) {
+    write_output(output_file.c_str(), get_plain_output());
+    return 0;
+  }
+  {
+    Phase phase("get_sa");
+    get_sa();
+  }
+  {
+    Phase phase("get_dict");
+    get_dict();
+  }
+  {
+    Phase phase("get_pfxs");
+    get_pfxs();
+  }
+  {
+    Phase phase("get_ids");
+    get_ids();
+  }
+  // print_hgt();
+  // fflush(stdout);
 
   refcnts.resize(id_size, 16);
+  exp_uses = occs;
   ldefs.resize(id_size);
   pens.resize(id_size);
   subs.resize(id_size);
-  refcnts.resize(id_size);
-  for (cnt_t i = 0; i < 1; i++) {
-    get_symbs();
-    ranges::fill(ldefs, remove_reference_t<decltype(ldefs[0])>{});
-    get_def<len_t>(doc_id);
-    fprintf(stderr, "iter(%d): doc_len = %d\n", i, ranges::min(ldefs[doc_id]));
-    fprintf(stderr, "retry_cnt = %zu, dp_cnt = %zu, backtrace_cnt = %zu\n",
-            retry_cnt, dp_cnt, backtrace_cnt);
-  }
-  write_output(output_file.c_str());
+  // the shortest output of a complete iteration so far
+  str_t best_output;
+  bool stopped = false;
+  for (size_t i = 0, last_output_len = 0; i < 20; i++) {
+    if (budgeted() && over_budget()) {
+      fprintf(stderr, "budget: stopped before iter #%zu\n", i);
+      stopped = true;
+      break;
+    }
+    {
+      Phase phase("get_symbs");
+      get_symbs();
+    }
+    {
+      Phase phase("get_defs");
+      stopped = !get_defs();
+    }
+    if (stopped) {
+      fprintf(stderr, "budget: stopped during iter #%zu\n", i);
+      break;
+    }
+    bool changed;
+    {
+      Phase phase("get_refcnts");
+      changed = get_refcnts();
+    }
+    const size_t output_len = get_output_len();
+    fprintf(stderr, "iter #%zu: output_len = %zu\n", i, output_len);
+    fprintf(stderr,
+            "retry_cnt = %zu, dp_cnt = %zu, backtrace_cnt = %zu, "
+            "eval_cnt = %zu / %zu\n",
+            retry_cnt.load(), dp_cnt.load(), backtrace_cnt.load(),
+            eval_cnt.exchange(0), ids.size());
+    if (best_output.empty() || output_len <= best_output.length()) {
+      best_output = get_output();
+    }
+    if (!changed || output_len == last_output_len) break;
+    last_output_len = output_len;
+  }
+  {
+    Phase phase("write_output");
+    const str_t plain_output = get_plain_output();
+    if (best_output.empty()) {
+      best_output = plain_output;
+    } else if (best_output.length() > plain_output.length()) {
+      fprintf(stderr,
+              "Warning: the output is %zu bytes, more than the %zu bytes of "
+              "the document without any #define.\n",
+              best_output.length(), plain_output.length());
+    }
+    write_output(output_file.c_str(), best_output);
+  }
+  print_phases();
+  if (args.size() > 3) write_trace(args[3]);
 }
@@ -0,0 +1,293 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+using id_t = uint32_t;   // identifier type
+using pos_t = size_t;    // position type
+using len_t = size_t;    // length type
+using str_t = string;    // string type
+
+constexpr id_t no_id = numeric_limits<id_t>::max();
+constexpr len_t no_len = numeric_limits<len_t>::max();
+// memos[id].first while id is being expanded
+constexpr pos_t in_progress = numeric_limits<pos_t>::max();
+constexpr string_view define_head = "#define ";
+constexpr string_view asm_head = "__asm__(";
+constexpr string_view asm_tail = ");";
+
+// A piece of a definition is either a symbol, or a string literal that is
+// lits[pos ... pos + len - 1] after unescaping.
+struct Piece {
+  id_t id;  // no_id for a string literal
+  pos_t pos;
+  len_t len;
+};
+
+// content of the compressed file
+string_view src;
+// symbol ids: sym2id[symbol] = id, where doc_ids are the __asm__ documents
+unordered_map<string_view, id_t> sym2id;
+vector<id_t> doc_ids;
+// symbols: symbs[id] = symbol
+vector<string_view> symbs;
+// bodies of definitions: bodies[id] = src[pos ... pos + len - 1]
+vector<pair<pos_t, len_t>> bodies;
+// definitions: defs[id] = {piece...}
+vector<vector<Piece>> defs;
+// unescaped string literals
+str_t lits;
+// memoized expansions: memos[id] = {position in out, length}, where the
+// length is no_len until the expansion is complete
+vector<pair<pos_t, len_t>> memos;
+// expansion of the documents, memos[doc_ids[k]] being the k-th one
+str_t out;
+
+// Maps file_name read-only.
+string_view map_file(const char *const file_name) {
+  const int fd = open(file_name, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    fprintf(stderr, "Error: cannot read file '%s'\n", file_name);
+    exit(1);
+  }
+  if (st.st_size == 0) return {};
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "Error: cannot map file '%s'\n", file_name);
+    exit(1);
+  }
+  close(fd);
+  return {static_cast<const char *>(addr), size_t(st.st_size)};
+}
+
+[[noreturn]] void parse_error(const pos_t pos, const char *const what) {
+  const pos_t line = count(src.begin(), src.begin() + pos, '\n') + 1;
+  fprintf(stderr, "Error: line %zu: %s\n", line, what);
+  exit(2);
+}
+
+bool is_symb_char(const char ch) {
+  return isalnum(uint8_t(ch)) || ch == '_' || ch == '$';
+}
+
+// Splits src into the #define lines and the __asm__ documents.
+void get_bodies() {
+  for (pos_t pos = 0; pos < src.length();) {
+    const pos_t eol = min(src.find('\n', pos), src.length());
+    const string_view line = src.substr(pos, eol - pos);
+    if (line.starts_with(define_head)) {
+      const pos_t symb_pos = pos + define_head.length();
+      pos_t symb_end = symb_pos;
+      while (symb_end < eol && is_symb_char(src[symb_end])) symb_end++;
+      const string_view symb = src.substr(symb_pos, symb_end - symb_pos);
+      if (symb.empty() || isdigit(uint8_t(symb[0]))) {
+        parse_error(pos, "bad symbol");
+      }
+      if (!sym2id.emplace(symb, symbs.size()).second) {
+        parse_error(pos, "symbol redefined");
+      }
+      symbs.push_back(symb);
+      bodies.push_back({symb_end, eol - symb_end});
+    } else if (line.starts_with(asm_head)) {
+      if (!line.ends_with(asm_tail)) {
+        parse_error(pos, "document is not terminated by ');'");
+      }
+      doc_ids.push_back(symbs.size());
+      symbs.push_back(asm_head);
+      bodies.push_back({pos + asm_head.length(),
+                        line.length() - asm_head.length() - asm_tail.length()});
+    } else if (!line.empty()) {
+      parse_error(pos, "neither #define nor __asm__");
+    }
+    pos = eol + 1;
+  }
+  if (doc_ids.empty()) {
+    fprintf(stderr, "Error: no __asm__ document.\n");
+    exit(2);
+  }
+}
+
+// Unescapes the string literal that starts at src[pos] into lits.
+// @return  the position after the closing quote.
+pos_t get_lit(pos_t pos, const pos_t end) {
+  assert(src[pos] == '"');
+  for (pos++; pos < end && src[pos] != '"'; pos++) {
+    if (src[pos] != '\\') {
+      lits += src[pos];
+      continue;
+    }
+    if (++pos == end) break;
+    const char ch = src[pos];
+    if ('0' <= ch && ch <= '7') {
+      int val = 0;
+      for (int k = 0; k < 3 && pos < end && '0' <= src[pos] && src[pos] <= '7';
+           k++) {
+        val = val * 8 + src[pos++] - '0';
+      }
+      lits += char(val);
+      pos--;
+    } else if (ch == 'n') {
+      lits += '\n';
+    } else if (ch == 't') {
+      lits += '\t';
+    } else if (ch == 'r') {
+      lits += '\r';
+    } else {
+      lits += ch;  // \", \\, \'
+    }
+  }
+  if (pos >= end) parse_error(pos, "unterminated string literal");
+  return pos + 1;
+}
+
+// Tokenizes every body into symbols and merged string literals.
+void get_defs() {
+  defs.resize(symbs.size());
+  for (id_t id = 0; id < symbs.size(); id++) {
+    const auto [body_pos, body_len] = bodies[id];
+    const pos_t end = body_pos + body_len;
+    vector<Piece> &def = defs[id];
+    for (pos_t pos = body_pos; pos < end;) {
+      const char ch = src[pos];
+      if (ch == ' ' || ch == '\t') {
+        pos++;
+      } else if (ch == '"') {
+        // adjacent string literals are merged, as the compiler does
+        if (def.empty() || def.back().id != no_id) {
+          def.push_back({no_id, lits.length(), 0});
+        }
+        pos = get_lit(pos, end);
+        def.back().len = lits.length() - def.back().pos;
+      } else if (is_symb_char(ch) && !isdigit(uint8_t(ch))) {
+        pos_t symb_end = pos;
+        while (symb_end < end && is_symb_char(src[symb_end])) symb_end++;
+        const auto it = sym2id.find(src.substr(pos, symb_end - pos));
+        if (it == sym2id.end()) parse_error(pos, "undefined symbol");
+        def.push_back({it->second, 0, 0});
+        pos = symb_end;
+      } else {
+        parse_error(pos, "unexpected character");
+      }
+    }
+  }
+}
+
+// Finishes the expansions on S, the innermost first.
+// S = {{id, index of the next piece, position in out}...}
+void expand_stack(vector<tuple<id_t, size_t, pos_t>> &S) {
+  while (!S.empty()) {
+    auto &[id, i, start] = S.back();
+    if (i == defs[id].size()) {
+      memos[id] = {start, out.length() - start};
+      S.pop_back();
+      continue;
+    }
+    const Piece &piece = defs[id][i++];
+    if (piece.id == no_id) {
+      out.append(lits, piece.pos, piece.len);
+      continue;
+    }
+    const auto [memo_pos, memo_len] = memos[piece.id];
+    if (memo_len != no_len) {
+      // out may reallocate, so it is grown before copying from itself
+      out.resize(out.length() + memo_len);
+      memcpy(out.data() + out.length() - memo_len, out.data() + memo_pos,
+             memo_len);
+    } else if (memo_pos == in_progress) {
+      fprintf(stderr, "Error: symbol '%.*s' is defined recursively.\n",
+              int(symbs[piece.id].length()), symbs[piece.id].data());
+      exit(2);
+    } else {
+      memos[piece.id].first = in_progress;
+      S.push_back({piece.id, 0, out.length()});
+    }
+  }
+}
+
+// Expands the documents one after another into out without recursion.  A
+// symbol is expanded once; later references, from any document, copy its
+// first expansion from out.
+void expand() {
+  memos.assign(symbs.size(), {0, no_len});
+  vector<tuple<id_t, size_t, pos_t>> S;
+  for (const id_t &doc_id : doc_ids) {
+    S.push_back({doc_id, 0, out.length()});
+    memos[doc_id].first = in_progress;
+    expand_stack(S);
+  }
+}
+
+void write_output(const int fd) {
+  for (pos_t pos = 0; pos < out.length();) {
+    const ssize_t ret = write(fd, out.data() + pos, out.length() - pos);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret == -1) {
+      fprintf(stderr, "Error: cannot write the output.\n");
+      exit(1);
+    }
+    pos += ret;
+  }
+}
+
+// Usage: decompress compressed_file [original_file...]
+// Without original_file the documents are written to stdout one after
+// another; otherwise the k-th document is compared with the k-th
+// original_file, and the exit code is 4 on a mismatch.
+int main(int argc, const char *argv[]) {
+  str_t input_file;
+  if (argc > 1) {
+    input_file = argv[1];
+  } else {
+    cout << "input_file: " << endl;
+    cin >> input_file;
+  }
+  src = map_file(input_file.c_str());
+  get_bodies();
+  get_defs();
+  expand();
+  fprintf(stderr, "%zu defines, %zu documents, %zu bytes -> %zu bytes\n",
+          symbs.size() - doc_ids.size(), doc_ids.size(), src.length(),
+          out.length());
+  if (argc <= 2) {
+    write_output(STDOUT_FILENO);
+    return 0;
+  }
+  if (size_t(argc - 2) != doc_ids.size()) {
+    fprintf(stderr, "Error: %zu documents but %d original files.\n",
+            doc_ids.size(), argc - 2);
+    return 4;
+  }
+  int ret = 0;
+  for (size_t k = 0; k < doc_ids.size(); k++) {
+    const auto [doc_pos, doc_len] = memos[doc_ids[k]];
+    const string_view document = string_view(out).substr(doc_pos, doc_len);
+    const string_view original = map_file(argv[k + 2]);
+    const auto [it, _] = ranges::mismatch(document, original);
+    if (it == document.end() && original.length() == document.length()) {
+      fprintf(stderr, "%s: OK\n", argv[k + 2]);
+      continue;
+    }
+    fprintf(stderr,
+            "%s: mismatch at byte %zu (expanded %zu, original %zu bytes)\n",
+            argv[k + 2], size_t(it - document.begin()), document.length(),
+            original.length());
+    ret = 4;
+  }
+  return ret;
+}
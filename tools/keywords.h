@@ -0,0 +1,15 @@
+#ifndef TOOLS_KEYWORDS_H_
+#define TOOLS_KEYWORDS_H_
+
+#include <string_view>
+#include <unordered_set>
+
+// Identifiers that compress and compress2 never generate as symbols: the
+// alternative tokens of C++, which are operators even to the preprocessor,
+// so "#define not ..." does not compile, the operator "defined", and the
+// __asm__ that the documents are wrapped in.
+inline const std::unordered_set<std::string_view> keywords = {
+    "and",    "and_eq", "bitand", "bitor",  "compl",   "not",    "not_eq",
+    "or",     "or_eq",  "xor",    "xor_eq", "defined", "__asm__"};
+
+#endif  // TOOLS_KEYWORDS_H_
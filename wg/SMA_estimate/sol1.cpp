@@ -1,9 +1,33 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
 #include <cmath>
-#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <map>
+#include <memory>
 #include <queue>
-#include <set>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 using namespace std;
 
 // Input format conventions:
@@ -20,10 +44,30 @@ using namespace std;
 // 8. For each but first lines of input, output 1 line, which containts 2
 //    floatings: the estimated SMA and the estimated error in parentheses;
 // 9. First output is nan, indicating the SMA is undefined at present.
+//
+// Binary format conventions (sol1 --binary):
+// 10. Input is a Header, followed by one Record {Timestamp, Price} per tick
+//     until EOF, in native byte order;
+// 11. Output is one Record {SMA, error} per tick.
+// sol1 --pack converts text input to binary input.
+//
+// Snapshot format conventions (sol1 --checkpoint, --restore):
+// 12. A snapshot is the state of SMA<true>, then that of SMA<false>, in
+//     native byte order;
+// 13. Each state is a Snapshot, followed by its size intervals from the
+//     oldest, as Snapshot_point for SMA<true> and dur_price for SMA<false>.
 
 using my_int_t = int64_t;   // conventions #5
 using my_float_t = double;  // conventions #6
 
+struct Header {  // conventions #10
+  my_float_t Win;
+  my_int_t Bin;
+};
+struct Record {  // conventions #10 #11
+  my_float_t first, second;
+};
+
 // Helper struct
 struct dur_price {
   my_float_t duration;
@@ -44,106 +88,333 @@ struct dur_price {
   }
   dur_price& shorten(const my_float_t& new_duration) {
     assert(new_duration <= duration);
-    price = price / duration * new_duration;
     duration = new_duration;
     assert(duration > 0);
     return *this;
   }
 };
 
-template <bool SpaceConstraint>
+// How running sums are accumulated:
+// plain: one double, to which every term added and subtracted leaves its
+//   rounding error, so that the error drifts with the number of ticks;
+// compensated: Neumaier's compensation, which carries the rounding errors
+//   in a second double, so that the error stays bounded by a few roundings
+//   of the sum itself, plus a second order term, however many ticks pass.
+//   It costs some throughput (see --bench, exact against exact_plain).
+enum class Accumulation { plain, compensated };
+
+template <Accumulation A = Accumulation::compensated>
+struct Sum {
+  my_float_t sum, err;  // the sum is sum + err, err staying 0 if plain
+  Sum& operator+=(const my_float_t x) {
+    if constexpr (A == Accumulation::plain) {
+      sum += x;
+      return *this;
+    }
+    const my_float_t t = sum + x;
+    err += abs(sum) >= abs(x) ? (sum - t) + x : (x - t) + sum;
+    sum = t;
+    return *this;
+  }
+  Sum& operator-=(const my_float_t x) { return *this += -x; }
+  my_float_t value() const { return sum + err; }
+};
+
+// Running total of intervals, kept as sums of duration and area (price *
+// duration). An interval has to be subtracted as it was added: one that
+// changes in between is subtracted before and added again after.
+template <Accumulation A = Accumulation::compensated>
+struct Total {
+  Sum<A> durations, areas;
+  Total& operator+=(const dur_price& t) {
+    return add(t.duration, t.price * t.duration);
+  }
+  Total& operator-=(const dur_price& t) {
+    return add(-t.duration, -(t.price * t.duration));
+  }
+  // Adds an interval of duration and area, or subtracts it if both are
+  // negated.
+  Total& add(const my_float_t duration, const my_float_t area) {
+    durations += duration, areas += area;
+    return *this;
+  }
+  my_float_t duration() const { return durations.value(); }
+  my_float_t area() const { return areas.value(); }
+  my_float_t price() const { return area() / duration(); }
+};
+
+// The layout is the same under either Accumulation, so a snapshot restores
+// into an SMA of the other one.
+template <Accumulation A>
+struct Snapshot {  // conventions #13
+  my_int_t Bin;     // 0 for SMA<false>
+  my_float_t Win;
+  Total<A> tot;
+  my_int_t size;
+};
+struct Snapshot_point {  // conventions #13
+  my_float_t time;
+  dur_price interval;
+};
+
+template <typename T>
+void append_raw(string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+// Reads value from the front of in, which is consumed.
+// @return  false if in is too short.
+template <typename T>
+bool read_raw(string_view& in, T& value) {
+  if (in.size() < sizeof(value)) return false;
+  memcpy(&value, in.data(), sizeof(value));
+  in.remove_prefix(sizeof(value));
+  return true;
+}
+
+// How SMA<true> drops a point when Bin + 1 are held:
+// merge_nearest: readme scheme 1, the point whose neighbours are nearest;
+// min_duration_product: readme scheme 2, keeping the Bin pseudo points of
+//   least error bound. A pseudo point at t* has the potential
+//   M* = min_j(M_j + L|t* - t_j|), so it never beats keeping the nearer
+//   t_j, and the best Bin points are the history but the point whose
+//   removal raises the bound the least: the one whose two intervals have
+//   the least product of durations. Nothing is resampled.
+enum class Scheme { merge_nearest, min_duration_product };
+
+// Scheme is for SMA<true> alone.
+template <bool SpaceConstraint, Scheme = Scheme::merge_nearest,
+          Accumulation = Accumulation::compensated>
 class SMA;
 
 // SMA with space constraint
+// The history points live in Bin + 1 preallocated slots, linked in time
+// order. An intrusive indexed min-heap orders the interior points by the
+// cost of merging them away under scheme S, so the point to go is found in
+// O(1) and updated in O(log(Bin)), and update() never allocates. Heap nodes
+// carry their keys, as a merge changes the keys of two points at once.
 // SMA performance:
 // Total time: O(n * log(Bin))
 // Total space: O(Bin)
-template <>
-class SMA<true> {
+template <Scheme S, Accumulation A>
+class SMA<true, S, A> {
  private:
-  const my_int_t Bin;
-  const my_float_t Win;
-  template <typename T>
-  struct MyComp {
-    const T& hist;
-    MyComp(const T& Hist_) : hist(Hist_) {}
-    bool operator()(const my_float_t time1, const my_float_t time2) const {
-      return make_pair(hist.at(time1).duration, time1) <
-             make_pair(hist.at(time2).duration, time2);
+  using slot_t = my_int_t;
+  static constexpr slot_t nil = -1;
+  struct Slot {
+    my_float_t time;
+    dur_price interval;  // from time to the time of next
+    slot_t prev, next;   // neighbours in time order
+    slot_t heap_pos;     // nil unless an interior point
+  };
+  struct Node {
+    my_float_t key, time;  // the key of slot
+    slot_t slot;
+    bool operator<(const Node& t) const {
+      return key < t.key || (key == t.key && time < t.time);
     }
   };
-  dur_price tot;
-  // hist[timestamp] = {duration, price};
-  map<my_float_t, dur_price> hist;
-  // que = {timestamp...} order by (hist[timestap].duration, timestamp)
-  set<my_float_t, MyComp<decltype(hist)>> que;
+  const my_int_t Bin;
+  const my_float_t Win;
+  Total<A> tot;
+  // slots[0 ... Bin], of which free_slots are unused
+  vector<Slot> slots;
+  vector<slot_t> free_slots;
+  slot_t oldest, newest;
+  // heap = {interior slot...}, heap[0] being the next to be merged away
+  vector<Node> heap;
 
  public:
   SMA(const my_int_t Bin_, const my_float_t Win_)
-      : Bin(Bin_), Win(Win_), tot{0, 0}, que{hist} {
+      : Bin(Bin_), Win(Win_), tot{}, oldest(nil), newest(nil) {
     assert(Win > 1 && Bin > 1);  // convention #2
+    slots.resize(Bin + 1);
+    for (slot_t s = Bin; s >= 0; s--) free_slots.push_back(s);
+    heap.reserve(Bin + 1);
   }
 
  private:
-  void erase(const decltype(hist)::iterator it) {
-    tot -= it->second;
-    que.erase(it->first);
-    hist.erase(it);
-  }
-  void insert(const remove_reference_t<decltype(*hist.begin())> h) {
-    tot += h.second;
-    hist.emplace(h);
-    que.emplace(h.first);
-  }
-  void merge(decltype(hist)::iterator it1, decltype(it1) it2) {
-    if (it1->first > it2->first) swap(it1, it2);
-    remove_reference_t<decltype(*it1)> replace = *it1;
-    replace.second += it2->second;
-    erase(it1), erase(it2);
-    insert(move(replace));
+  // Merging slot s into its prev gives an interval of their total duration
+  // (merge_nearest) and raises the sum of squared durations in the readme
+  // bound by twice their product (min_duration_product).
+  Node node(const slot_t s) const {
+    const Slot& slot = slots[s];
+    const my_float_t d = slots[slot.prev].interval.duration;
+    if constexpr (S == Scheme::min_duration_product) {
+      return {d * slot.interval.duration, slot.time, s};
+    }
+    return {d + slot.interval.duration, slot.time, s};
+  }
+  void heap_set(const slot_t pos, const Node& node) {
+    heap[pos] = node;
+    slots[node.slot].heap_pos = pos;
+  }
+  void sift_up(slot_t pos, const Node& node) {
+    for (slot_t up; pos && node < heap[up = (pos - 1) / 2]; pos = up) {
+      heap_set(pos, heap[up]);
+    }
+    heap_set(pos, node);
+  }
+  void sift_down(slot_t pos, const Node& node) {
+    const slot_t size = heap.size();
+    for (slot_t down; (down = pos * 2 + 1) < size; pos = down) {
+      if (down + 1 < size && heap[down + 1] < heap[down]) down++;
+      if (!(heap[down] < node)) break;
+      heap_set(pos, heap[down]);
+    }
+    heap_set(pos, node);
+  }
+  // Places node at pos, which it may have to leave either way.
+  void sift(const slot_t pos, const Node& node) {
+    pos && node < heap[(pos - 1) / 2] ? sift_up(pos, node)
+                                      : sift_down(pos, node);
+  }
+  // Restores the heap after the key or the neighbours of slot s changed.
+  void refresh(const slot_t s) {
+    Slot& slot = slots[s];
+    const bool interior = slot.prev != nil && slot.next != nil;
+    if (slot.heap_pos == nil) {
+      if (!interior) return;
+      heap.emplace_back();
+      sift_up(heap.size() - 1, node(s));
+    } else if (interior) {
+      sift(slot.heap_pos, node(s));
+    } else {
+      const slot_t pos = slot.heap_pos;
+      const Node last = heap.back();
+      slot.heap_pos = nil;
+      heap.pop_back();
+      if (last.slot != s) sift(pos, last);
+    }
+  }
+  // Unlinks slot s and returns it to free_slots.
+  void erase(const slot_t s) {
+    const auto [prev, next] = make_pair(slots[s].prev, slots[s].next);
+    (prev == nil ? oldest : slots[prev].next) = next;
+    (next == nil ? newest : slots[next].prev) = prev;
+    slots[s].prev = slots[s].next = nil;
+    refresh(s);
+    free_slots.push_back(s);
+    if (prev != nil) refresh(prev);
+    if (next != nil) refresh(next);
   }
   void reduce() {
-    if (hist.empty()) return;
-    for (auto old = hist.begin();
-         hist.size() > 1 && tot.duration - old->second.duration >= Win;
-         old = hist.begin()) {
-      assert(old->second.duration > 0);  // convention #4
-      erase(old);
+    for (Slot* old = &slots[oldest];
+         oldest != newest && tot.duration() - old->interval.duration >= Win;
+         old = &slots[oldest]) {
+      assert(old->interval.duration > 0);  // convention #4
+      tot -= old->interval;
+      erase(oldest);
     }
-    if (tot.duration > Win) {
-      auto replace = *hist.begin();
-      erase(hist.begin());
-      auto new_duration = Win - tot.duration;
-      replace.second.shorten(new_duration);
-      insert(move(replace));
-      assert(tot.duration == Win);
+    if (tot.duration() > Win) {
+      Slot& old = slots[oldest];
+      const my_float_t excess = tot.duration() - Win;
+      tot -= old.interval;
+      old.interval.shorten(old.interval.duration - excess);
+      tot += old.interval;
+      refresh(old.next);
     }
-    while (my_int_t(que.size()) > Bin) {
-      auto it1 = hist.find(*que.begin()), it2 = it1;
-      assert(it1 != hist.end());
-      it1 == hist.begin() ? it2++ : it2--;
-      assert(it2 != --hist.end());
-      merge(it1, it2);
+    if (free_slots.empty()) {
+      const slot_t s = heap.front().slot;
+      dur_price& prev = slots[slots[s].prev].interval;
+      tot -= prev, tot -= slots[s].interval;
+      prev += slots[s].interval;
+      tot += prev;
+      erase(s);
     }
+    assert(heap_ok());
   }
+#ifndef NDEBUG
+  // @return  whether heap holds every interior slot, each under the key it
+  // has now and no less than its parent, so a key left stale by a merge or
+  // a neighbour not re-sifted is caught in debug builds.
+  bool heap_ok() const {
+    slot_t interior = 0;
+    for (slot_t s = oldest; s != nil; s = slots[s].next) {
+      interior += slots[s].prev != nil && slots[s].next != nil;
+    }
+    if (interior != slot_t(heap.size())) return false;
+    for (slot_t pos = 0; pos < slot_t(heap.size()); pos++) {
+      const Node& n = heap[pos];
+      const Node now = node(n.slot);
+      if (slots[n.slot].heap_pos != pos || now.key != n.key ||
+          now.time != n.time || (pos && n < heap[(pos - 1) / 2])) {
+        return false;
+      }
+    }
+    return true;
+  }
+#endif
 
  public:
   SMA& update(const my_float_t time, const my_float_t price) {
-    if (!hist.empty()) {
-      auto replace = *--hist.end();
-      hist.erase(--hist.end());
-      replace.second.duration = time - replace.first;
-      assert(replace.second.duration > 0);  // convention #4
-      insert(move(replace));
-    }
-    hist.insert({time, {0, price}});
+    const slot_t s = free_slots.back();
+    free_slots.pop_back();
+    slots[s] = {time, {0, price}, newest, nil, nil};
+    if (newest != nil) {
+      Slot& last = slots[newest];
+      last.interval.duration = time - last.time;
+      assert(last.interval.duration > 0);  // convention #4
+      tot += last.interval;
+      last.next = s;
+      refresh(newest);
+    } else {
+      oldest = s;
+    }
+    newest = s;
     reduce();
     return *this;
   }
   my_float_t get() const {
-    assert(tot.duration <= Win);
-    return tot.duration ? tot.price : nanl("SMA is undefined.");
-    ;
+    assert(tot.duration() <= Win);
+    return tot.duration() ? tot.price() : nanl("SMA is undefined.");
+  }
+  // Appends the state to snapshot (conventions #13).
+  void checkpoint(string& snapshot) const {
+    Snapshot<A> header = {Bin, Win, tot, 0};
+    for (slot_t s = oldest; s != nil; s = slots[s].next) header.size++;
+    append_raw(snapshot, header);
+    for (slot_t s = oldest; s != nil; s = slots[s].next) {
+      append_raw(snapshot, Snapshot_point{slots[s].time, slots[s].interval});
+    }
+  }
+  // Replaces the state by the one at the front of snapshot, which is
+  // consumed, in O(size) with the heap built bottom-up.
+  // @return  false if snapshot is truncated or taken with other Bin or Win.
+  bool restore(string_view& snapshot) {
+    Snapshot<A> header;
+    if (!read_raw(snapshot, header) || header.Bin != Bin ||
+        header.Win != Win || header.size < 0 || header.size > Bin ||
+        snapshot.size() / sizeof(Snapshot_point) < size_t(header.size)) {
+      return false;
+    }
+    const slot_t size = header.size;
+    tot = header.tot;
+    for (slot_t s = 0; s < size; s++) {
+      Snapshot_point point;
+      read_raw(snapshot, point);
+      slots[s] = {point.time, point.interval, s - 1,
+                  s + 1 < size ? s + 1 : nil, nil};
+    }
+    oldest = size ? 0 : nil, newest = size - 1;
+    free_slots.clear();
+    for (slot_t s = Bin; s >= size; s--) free_slots.push_back(s);
+    heap.clear();
+    for (slot_t s = 1; s + 1 < size; s++) {
+      heap.emplace_back();
+      heap_set(heap.size() - 1, node(s));
+    }
+    for (slot_t pos = heap.size() / 2; pos--;) {
+      const Node node = heap[pos];
+      sift_down(pos, node);
+    }
+    assert(heap_ok());
+    return true;
+  }
+  // @return  the bytes held, all of which are allocated up front.
+  size_t memory() const {
+    return sizeof(*this) + slots.capacity() * sizeof(Slot) +
+           free_slots.capacity() * sizeof(slot_t) +
+           heap.capacity() * sizeof(Node);
   }
 };
 
@@ -151,28 +422,30 @@ class SMA<true> {
 // SMA_std performance:
 // Total time: O(n)
 // Total space: O(n)
-template <>
-class SMA<false> {
+template <Accumulation A>
+class SMA<false, Scheme::merge_nearest, A> {
   const my_float_t Win;
   deque<dur_price> que;
-  dur_price tot;
+  Total<A> tot;
   void reduce() {
     if (que.empty()) return;
     for (auto old = que.front();
-         que.size() > 1 && tot.duration - old.duration >= Win;
+         que.size() > 1 && tot.duration() - old.duration >= Win;
          old = que.front()) {
       assert(old.duration > 0);  // convention #4
       tot -= old;
       que.pop_front();
     }
-    if (tot.duration > Win) {
-      auto new_duration = que.front().duration - (tot.duration - Win);
-      que.front().shorten(new_duration);
+    if (tot.duration() > Win) {
+      const my_float_t excess = tot.duration() - Win;
+      tot -= que.front();
+      que.front().shorten(que.front().duration - excess);
+      tot += que.front();
     }
   }
 
  public:
-  SMA(my_float_t Win_) : Win(Win_), tot{0, 0} {}
+  SMA(my_float_t Win_) : Win(Win_), tot{} {}
   SMA& update(const my_float_t time, const my_float_t price) {
     if (!que.empty()) {
       que.back().duration += time;
@@ -183,25 +456,1331 @@ class SMA<false> {
     return *this;
   }
   my_float_t get() const {
-    assert(tot.duration <= Win);
-    return tot.duration ? tot.price : nanl("SMA is undefined.");
+    assert(tot.duration() <= Win);
+    return tot.duration() ? tot.price() : nanl("SMA is undefined.");
+  }
+  // Appends the state to snapshot (conventions #13), the last interval
+  // being open, with the negated time of its start as duration.
+  void checkpoint(string& snapshot) const {
+    append_raw(snapshot, Snapshot<A>{0, Win, tot, my_int_t(que.size())});
+    for (const dur_price& interval : que) append_raw(snapshot, interval);
+  }
+  // Replaces the state by the one at the front of snapshot, which is
+  // consumed.
+  // @return  false if snapshot is truncated or taken with another Win.
+  bool restore(string_view& snapshot) {
+    Snapshot<A> header;
+    if (!read_raw(snapshot, header) || header.Bin != 0 ||
+        header.Win != Win || header.size < 0 ||
+        snapshot.size() / sizeof(dur_price) < size_t(header.size)) {
+      return false;
+    }
+    tot = header.tot;
+    que.resize(header.size);
+    for (dur_price& interval : que) read_raw(snapshot, interval);
+    return true;
+  }
+  // @return  the bytes held by the intervals in the window at present.
+  size_t memory() const {
+    return sizeof(*this) + que.size() * sizeof(dur_price);
+  }
+};
+
+// SMA without space constraint over late ticks
+// Ticks may come out of order, up to Lateness behind the latest one, and a
+// tick at the time of another corrects its price. The ticks of the window
+// are kept by time, so a late tick finds its place by binary search and
+// moves only the ticks on its shorter side, which are few if it is only
+// slightly late. It changes the total by the change of price over the
+// interval it takes over, clipped to the window, so the window is never
+// re-summed and get() stays O(1). A tick at or before the edge of the
+// window, which Lateness > Win allows, takes the place of the one in effect
+// there, if it is no older, so the edge never moves back (see --late).
+// SMA_late performance:
+// Time per tick: O(1) amortized in order, O(log(n) + ticks moved) if late
+// Total space: O(n)
+template <Accumulation A = Accumulation::compensated>
+class SMA_late {
+  struct Tick {
+    my_float_t time, price;
+  };
+  const my_float_t Win, Lateness;
+  // ticks by time, ticks[0] being the one in effect at edge
+  deque<Tick> ticks;
+  my_float_t edge;  // tot is over [edge, time of the latest tick]
+  Total<A> tot;
+  void reduce() {
+    const my_float_t cutoff = ticks.back().time - Win;
+    while (edge < cutoff) {
+      const my_float_t cut = min(ticks[1].time, cutoff);
+      tot -= {cut - edge, ticks[0].price};
+      if ((edge = cut) == ticks[1].time) ticks.pop_front();
+    }
+  }
+
+ public:
+  SMA_late(const my_float_t Win_, const my_float_t Lateness_)
+      : Win(Win_), Lateness(Lateness_), edge(0), tot{} {
+    assert(Win > 1 && Lateness >= 0);  // convention #2
+  }
+  // @return  false if the tick is more than Lateness late, and ignored.
+  bool update(const my_float_t time, const my_float_t price) {
+    if (ticks.empty() || time > ticks.back().time) {
+      if (!ticks.empty()) {
+        tot += {time - ticks.back().time, ticks.back().price};
+      } else {
+        edge = time;
+      }
+      ticks.push_back({time, price});
+      reduce();
+      return true;
+    }
+    if (time < ticks.back().time - Lateness) return false;
+    if (time < ticks.front().time) return true;  // before the window
+    if (time <= edge) {
+      const my_float_t overlap = ticks.size() > 1 ? ticks[1].time - edge : 0;
+      if (overlap > 0) {
+        tot -= {overlap, ticks[0].price};
+        tot += {overlap, price};
+      }
+      ticks[0] = {time, price};
+      return true;
+    }
+    auto it = lower_bound(
+        ticks.begin(), ticks.end(), time,
+        [](const Tick& tick, const my_float_t t) { return tick.time < t; });
+    const bool correction = it->time == time;
+    const my_float_t old_price = correction ? it->price : prev(it)->price;
+    const my_float_t next_time =
+        correction ? (next(it) == ticks.end() ? time : next(it)->time)
+                   : it->time;
+    const my_float_t overlap = next_time - time;
+    if (overlap > 0) {
+      tot -= {overlap, old_price};
+      tot += {overlap, price};
+    }
+    if (correction) {
+      it->price = price;
+    } else {
+      ticks.insert(it, {time, price});
+    }
+    return true;
+  }
+  my_float_t get() const {
+    assert(tot.duration() <= Win);
+    return tot.duration() ? tot.price() : nanl("SMA is undefined.");
+  }
+};
+
+// Multi-symbol SMA with space constraint
+// Each symbol is organized as in SMA<true>, in one block of its own: Bin + 1
+// slots and a heap whose nodes carry their keys, so that sifting reads the
+// heap alone. Intervals and totals are kept as (duration, area), area being
+// price * duration, so that updates add and subtract without dividing, and
+// the totals of all symbols are laid out as structure of arrays for get(),
+// summed under A as in SMA<true>. A batch of ticks hides the cache misses of
+// scattered symbols by prefetching the state of the symbols a few ticks
+// ahead.
+// SMA_batch performance:
+// Total time: O(n * log(Bin))
+// Total space: O(Symbols * Bin)
+template <Accumulation A = Accumulation::compensated>
+class SMA_batch {
+ public:
+  struct Tick {
+    my_int_t symbol;
+    my_float_t time;
+    my_float_t price;
+  };
+
+ private:
+  using slot_t = int32_t;
+  static constexpr slot_t nil = -1;
+  static constexpr size_t prefetch_distance = 8;
+  struct Slot {
+    my_float_t time;
+    my_float_t duration, area;  // of the interval to the time of next
+    slot_t prev, next;          // neighbours in time order, or the free list
+    slot_t heap_pos;            // nil unless an interior point
+  };
+  struct Node {
+    my_float_t merged, time;  // the key of slot
+    slot_t slot;
+    bool operator<(const Node& t) const {
+      return merged < t.merged || (merged == t.merged && time < t.time);
+    }
+  };
+  struct Series {
+    my_float_t last_price;  // price of the open interval
+    slot_t oldest, newest, free_head, heap_size;
+  };
+  const my_int_t Symbols;
+  const my_int_t Bin;
+  const my_float_t Win;
+  vector<Sum<A>> tot_duration, tot_area;
+  vector<Series> series;
+  // slots[s * (Bin + 1) ... s * (Bin + 1) + Bin] belong to symbol s, and so
+  // do the nodes of its heap
+  vector<Slot> slots;
+  vector<Node> heap;
+
+ public:
+  SMA_batch(const my_int_t Symbols_, const my_int_t Bin_,
+            const my_float_t Win_)
+      : Symbols(Symbols_), Bin(Bin_), Win(Win_) {
+    assert(Win > 1 && Bin > 1);  // convention #2
+    assert(Symbols > 0 && Bin < INT32_MAX);
+    tot_duration.assign(Symbols, {}), tot_area.assign(Symbols, {});
+    series.assign(Symbols, {0, nil, nil, 0, 0});
+    slots.resize(Symbols * (Bin + 1));
+    heap.resize(Symbols * (Bin + 1));
+    for (size_t i = 0; i < slots.size(); i++) {
+      slots[i].next = i % (Bin + 1) == size_t(Bin) ? nil : i % (Bin + 1) + 1;
+    }
+  }
+
+ private:
+  // The state of symbol s, while it is being updated.
+  struct View {
+    Series& series;
+    Slot* slots;
+    Node* heap;
+    Node node(const slot_t k) const {
+      const Slot& slot = slots[k];
+      return {slots[slot.prev].duration + slot.duration, slot.time, k};
+    }
+    void set(const slot_t pos, const Node& node) {
+      heap[pos] = node;
+      slots[node.slot].heap_pos = pos;
+    }
+    void sift_up(slot_t pos, const Node& node) {
+      for (slot_t up; pos && node < heap[up = (pos - 1) / 2]; pos = up) {
+        set(pos, heap[up]);
+      }
+      set(pos, node);
+    }
+    void sift_down(slot_t pos, const Node& node) {
+      const slot_t size = series.heap_size;
+      for (slot_t down; (down = pos * 2 + 1) < size; pos = down) {
+        if (down + 1 < size && heap[down + 1] < heap[down]) down++;
+        if (!(heap[down] < node)) break;
+        set(pos, heap[down]);
+      }
+      set(pos, node);
+    }
+    // Places node at pos, which it may have to leave either way.
+    void sift(const slot_t pos, const Node& node) {
+      pos && node < heap[(pos - 1) / 2] ? sift_up(pos, node)
+                                        : sift_down(pos, node);
+    }
+    // Restores the heap after the key or the neighbours of slot k changed.
+    void refresh(const slot_t k) {
+      Slot& slot = slots[k];
+      const bool interior = slot.prev != nil && slot.next != nil;
+      if (slot.heap_pos == nil) {
+        if (interior) sift_up(series.heap_size++, node(k));
+      } else if (interior) {
+        sift(slot.heap_pos, node(k));
+      } else {
+        const slot_t pos = slot.heap_pos;
+        const Node last = heap[--series.heap_size];
+        slot.heap_pos = nil;
+        if (last.slot != k) sift(pos, last);
+      }
+    }
+    // Unlinks slot k and returns it to the free list.
+    void erase(const slot_t k) {
+      const slot_t p = slots[k].prev, n = slots[k].next;
+      (p == nil ? series.oldest : slots[p].next) = n;
+      (n == nil ? series.newest : slots[n].prev) = p;
+      slots[k].prev = slots[k].next = nil;
+      refresh(k);
+      slots[k].next = series.free_head;
+      series.free_head = k;
+      if (p != nil) refresh(p);
+      if (n != nil) refresh(n);
+    }
+  };
+
+  void reduce(const my_int_t s, View& v) {
+    Series& series = v.series;
+    for (Slot* old = &v.slots[series.oldest];
+         series.oldest != series.newest &&
+         tot_duration[s].value() - old->duration >= Win;
+         old = &v.slots[series.oldest]) {
+      assert(old->duration > 0);  // convention #4
+      tot_duration[s] -= old->duration, tot_area[s] -= old->area;
+      v.erase(series.oldest);
+    }
+    if (tot_duration[s].value() > Win) {
+      Slot& old = v.slots[series.oldest];
+      const my_float_t excess = tot_duration[s].value() - Win;
+      const my_float_t cut = old.area / old.duration * excess;
+      tot_duration[s] -= excess, tot_area[s] -= cut;
+      old.duration -= excess, old.area -= cut;
+      v.refresh(old.next);
+    }
+    if (series.free_head == nil) {
+      const slot_t k = v.heap[0].slot;
+      Slot& prev = v.slots[v.slots[k].prev];
+      prev.duration += v.slots[k].duration, prev.area += v.slots[k].area;
+      v.erase(k);
+    }
+  }
+  void prefetch(const my_int_t s) const {
+    const Series& ser = series[s];
+    __builtin_prefetch(&tot_duration[s]), __builtin_prefetch(&tot_area[s]);
+    __builtin_prefetch(&heap[s * (Bin + 1)]);
+    if (ser.newest != nil) {
+      __builtin_prefetch(&slots[s * (Bin + 1) + ser.newest]);
+      __builtin_prefetch(&slots[s * (Bin + 1) + ser.oldest]);
+    }
+  }
+
+ public:
+  SMA_batch& update(const my_int_t s, const my_float_t t, const my_float_t p) {
+    assert(0 <= s && s < Symbols);
+    View v{series[s], &slots[s * (Bin + 1)], &heap[s * (Bin + 1)]};
+    const slot_t k = v.series.free_head, last = v.series.newest;
+    v.series.free_head = v.slots[k].next;
+    v.slots[k] = {t, 0, 0, last, nil, nil};
+    if (last != nil) {
+      Slot& slot = v.slots[last];
+      slot.duration = t - slot.time;
+      assert(slot.duration > 0);  // convention #4
+      slot.area = v.series.last_price * slot.duration;
+      tot_duration[s] += slot.duration, tot_area[s] += slot.area;
+      slot.next = k;
+      v.refresh(last);
+    } else {
+      v.series.oldest = k;
+    }
+    v.series.newest = k, v.series.last_price = p;
+    reduce(s, v);
+    return *this;
+  }
+  // Applies ticks in order, while the state of the symbols a few ticks ahead
+  // is prefetched.
+  SMA_batch& update(const span<const Tick> ticks) {
+    for (size_t i = 0; i < ticks.size(); i++) {
+      if (i + prefetch_distance < ticks.size()) {
+        __builtin_prefetch(&series[ticks[i + prefetch_distance].symbol]);
+      }
+      if (i + prefetch_distance / 2 < ticks.size()) {
+        prefetch(ticks[i + prefetch_distance / 2].symbol);
+      }
+      update(ticks[i].symbol, ticks[i].time, ticks[i].price);
+    }
+    return *this;
+  }
+  my_float_t get(const my_int_t s) const {
+    const my_float_t duration = tot_duration[s].value();
+    assert(duration <= Win);
+    return duration ? tot_area[s].value() / duration
+                    : nanl("SMA is undefined.");
+  }
+  // sma[s] = get(s) for every symbol, two at a time with SSE2. An undefined
+  // SMA is 0 / 0, which is nan.
+  void get(const span<my_float_t> sma) const {
+    assert(sma.size() == size_t(Symbols));
+    size_t s = 0;
+#ifdef __SSE2__
+    // {sum + err} of sums[0] and sums[1]
+    const auto values = [](const Sum<A>* const sums) {
+      const __m128d a = _mm_loadu_pd(&sums[0].sum);
+      const __m128d b = _mm_loadu_pd(&sums[1].sum);
+      return _mm_add_pd(_mm_unpacklo_pd(a, b), _mm_unpackhi_pd(a, b));
+    };
+    for (; s + 2 <= sma.size(); s += 2) {
+      _mm_storeu_pd(&sma[s], _mm_div_pd(values(&tot_area[s]),
+                                        values(&tot_duration[s])));
+    }
+#endif
+    for (; s < sma.size(); s++) {
+      sma[s] = tot_area[s].value() / tot_duration[s].value();
+    }
+  }
+  // @return  the bytes held, all of which are allocated up front.
+  size_t memory() const {
+    return sizeof(*this) +
+           (tot_duration.capacity() + tot_area.capacity()) * sizeof(Sum<A>) +
+           series.capacity() * sizeof(Series) +
+           slots.capacity() * sizeof(Slot) + heap.capacity() * sizeof(Node);
+  }
+};
+
+// Multi-horizon SMA with space constraint
+// One history of Bin + 1 slots, organized as in SMA<true>, serves every
+// window in Wins. The oldest interval is not shortened; instead, each
+// horizon keeps its bound, the oldest slot whose interval reaches into its
+// window, with the totals of the intervals after it, and get() cuts the
+// bound. A point is keyed by its merged duration relative to the shortest
+// window it is in, so the bins thin out as the points age into longer
+// windows, and each horizon reports the readme error bound divided by L.
+// The totals are summed under A, as in SMA<false>.
+// SMA_multi performance:
+// Total time: O(n * Wins * log(Bin))
+// Total space: O(Bin + Wins)
+template <Accumulation A = Accumulation::compensated>
+class SMA_multi {
+ private:
+  using slot_t = my_int_t;
+  static constexpr slot_t nil = -1;
+  struct Slot {
+    my_float_t time;
+    my_float_t duration, area;  // of the interval to the time of next
+    slot_t prev, next;          // neighbours in time order
+    slot_t heap_pos;            // nil unless an interior point
+    my_int_t horizon;           // the shortest window the point is in
+  };
+  struct Node {
+    my_float_t merged, time;  // the key of slot
+    slot_t slot;
+    bool operator<(const Node& t) const {
+      return merged < t.merged || (merged == t.merged && time < t.time);
+    }
+  };
+  struct Horizon {
+    my_float_t Win;
+    slot_t bound;
+    // totals of the intervals after bound, square being sum of duration^2
+    Total<A> tot;
+    Sum<A> square;
+  };
+  const my_int_t Bin;
+  // horizons by increasing Win
+  vector<Horizon> horizons;
+  my_float_t last_price;  // price of the open interval
+  // slots[0 ... Bin], of which free_slots are unused
+  vector<Slot> slots;
+  vector<slot_t> free_slots;
+  slot_t oldest, newest;
+  // heap = {interior slot...}, heap[0] being the next to be merged away
+  vector<Node> heap;
+
+ public:
+  SMA_multi(const my_int_t Bin_, const vector<my_float_t>& Wins)
+      : Bin(Bin_), last_price(0), oldest(nil), newest(nil) {
+    assert(Bin > 1 && !Wins.empty());  // convention #2
+    for (const my_float_t& Win : Wins) {
+      assert(Win > 1);  // convention #2
+      horizons.push_back({Win, nil, {}, {}});
+    }
+    sort(horizons.begin(), horizons.end(),
+         [](const Horizon& a, const Horizon& b) { return a.Win < b.Win; });
+    slots.resize(Bin + 1);
+    for (slot_t s = Bin; s >= 0; s--) free_slots.push_back(s);
+    heap.reserve(Bin + 1);
+  }
+
+ private:
+  // Merging slot s into its prev, relative to the shortest window of s.
+  Node node(const slot_t s) const {
+    const Slot& slot = slots[s];
+    return {(slots[slot.prev].duration + slot.duration) /
+                horizons[slot.horizon].Win,
+            slot.time, s};
+  }
+  void heap_set(const slot_t pos, const Node& node) {
+    heap[pos] = node;
+    slots[node.slot].heap_pos = pos;
+  }
+  void sift_up(slot_t pos, const Node& node) {
+    for (slot_t up; pos && node < heap[up = (pos - 1) / 2]; pos = up) {
+      heap_set(pos, heap[up]);
+    }
+    heap_set(pos, node);
+  }
+  void sift_down(slot_t pos, const Node& node) {
+    const slot_t size = heap.size();
+    for (slot_t down; (down = pos * 2 + 1) < size; pos = down) {
+      if (down + 1 < size && heap[down + 1] < heap[down]) down++;
+      if (!(heap[down] < node)) break;
+      heap_set(pos, heap[down]);
+    }
+    heap_set(pos, node);
+  }
+  void sift(const slot_t pos, const Node& node) {
+    pos && node < heap[(pos - 1) / 2] ? sift_up(pos, node)
+                                      : sift_down(pos, node);
+  }
+  // Restores the heap after the key or the neighbours of slot s changed.
+  void refresh(const slot_t s) {
+    Slot& slot = slots[s];
+    const bool interior = slot.prev != nil && slot.next != nil;
+    if (slot.heap_pos == nil) {
+      if (!interior) return;
+      heap.emplace_back();
+      sift_up(heap.size() - 1, node(s));
+    } else if (interior) {
+      sift(slot.heap_pos, node(s));
+    } else {
+      const slot_t pos = slot.heap_pos;
+      const Node last = heap.back();
+      slot.heap_pos = nil;
+      heap.pop_back();
+      if (last.slot != s) sift(pos, last);
+    }
+  }
+  // Unlinks slot s and returns it to free_slots.
+  void erase(const slot_t s) {
+    const auto [prev, next] = make_pair(slots[s].prev, slots[s].next);
+    (prev == nil ? oldest : slots[prev].next) = next;
+    (next == nil ? newest : slots[next].prev) = prev;
+    slots[s].prev = slots[s].next = nil;
+    refresh(s);
+    free_slots.push_back(s);
+    if (prev != nil) refresh(prev);
+    if (next != nil) refresh(next);
+  }
+  void reduce() {
+    const my_float_t now = slots[newest].time;
+    for (my_int_t h = 0; h < my_int_t(horizons.size()); h++) {
+      Horizon& hz = horizons[h];
+      // the interval of bound has left the window, and the next one leaves
+      // the totals
+      for (slot_t s; hz.bound != newest &&
+                     slots[s = slots[hz.bound].next].time <= now - hz.Win;) {
+        const Slot& slot = slots[hz.bound = s];
+        hz.tot.add(-slot.duration, -slot.area);
+        hz.square -= slot.duration * slot.duration;
+        slots[s].horizon = h + 1;
+        if (h + 1 < my_int_t(horizons.size())) refresh(s);
+      }
+    }
+    while (oldest != horizons.back().bound) erase(oldest);
+    if (free_slots.empty()) {
+      const slot_t s = heap.front().slot;
+      Slot &slot = slots[s], &prev = slots[slot.prev];
+      for (Horizon& hz : horizons) {
+        if (hz.bound == s) {
+          hz.bound = slot.prev;
+        } else if (hz.bound == slot.prev) {
+          hz.tot.add(-slot.duration, -slot.area);
+          hz.square -= slot.duration * slot.duration;
+        } else if (prev.time > slots[hz.bound].time) {
+          hz.square += 2 * prev.duration * slot.duration;
+        }
+      }
+      prev.duration += slot.duration, prev.area += slot.area;
+      erase(s);
+    }
+  }
+
+ public:
+  SMA_multi& update(const my_float_t time, const my_float_t price) {
+    const slot_t s = free_slots.back();
+    free_slots.pop_back();
+    slots[s] = {time, 0, 0, newest, nil, nil, 0};
+    if (newest != nil) {
+      Slot& last = slots[newest];
+      last.duration = time - last.time;
+      assert(last.duration > 0);  // convention #4
+      last.area = last_price * last.duration;
+      last.next = s;
+      for (Horizon& hz : horizons) {
+        if (hz.bound == newest) continue;
+        hz.tot.add(last.duration, last.area);
+        hz.square += last.duration * last.duration;
+      }
+      refresh(newest);
+    } else {
+      oldest = s;
+      for (Horizon& hz : horizons) hz.bound = s;
+    }
+    newest = s, last_price = price;
+    reduce();
+    return *this;
+  }
+  my_int_t size() const { return horizons.size(); }
+  my_float_t Win(const my_int_t h) const { return horizons[h].Win; }
+  // @return  the SMA over the h-th shortest window.
+  my_float_t get(const my_int_t h) const {
+    const Horizon& hz = horizons[h];
+    if (newest == nil || hz.bound == newest) return nanl("SMA is undefined.");
+    const Slot& bound = slots[hz.bound];
+    const my_float_t cutoff = slots[newest].time - hz.Win;
+    const my_float_t overlap =
+        min(bound.duration, slots[bound.next].time - cutoff);
+    return (hz.tot.area() + bound.area / bound.duration * overlap) /
+           (hz.tot.duration() + overlap);
+  }
+  // @return  the error bound of get(h) divided by the Lipschitz constant L:
+  // the sum of (t_i - t_{i-1})^2 over the window, divided by 2 * Win.
+  my_float_t bound(const my_int_t h) const {
+    const Horizon& hz = horizons[h];
+    if (newest == nil || hz.bound == newest) return nanl("SMA is undefined.");
+    const my_float_t duration = slots[hz.bound].duration;
+    return (hz.square.value() + duration * duration) / (2 * hz.Win);
+  }
+  // @return  the bytes held, all of which are allocated up front.
+  size_t memory() const {
+    return sizeof(*this) + horizons.capacity() * sizeof(Horizon) +
+           slots.capacity() * sizeof(Slot) +
+           free_slots.capacity() * sizeof(slot_t) +
+           heap.capacity() * sizeof(Node);
+  }
+};
+
+// Single-producer single-consumer lock-free ring of ticks
+// The consumer reads the ticks in place and releases them once applied.
+class SPSC_ring {
+ private:
+  using Tick = SMA_batch<>::Tick;
+  vector<Tick> buf;
+  const size_t mask;
+  // head is only written by the producer, tail by the consumer, and each
+  // side caches the other's index to touch its cache line less often
+  alignas(64) atomic<size_t> head;
+  size_t tail_cache;
+  alignas(64) atomic<size_t> tail;
+  size_t head_cache;
+
+ public:
+  explicit SPSC_ring(const size_t Capacity)
+      : buf(Capacity), mask(Capacity - 1), head(0), tail_cache(0), tail(0),
+        head_cache(0) {
+    assert(Capacity && (Capacity & mask) == 0);  // a power of 2
+  }
+  // @return  false if the ring is full.
+  bool push(const Tick& tick) {
+    const size_t h = head.load(memory_order_relaxed);
+    if (h - tail_cache == buf.size()) {
+      tail_cache = tail.load(memory_order_acquire);
+      if (h - tail_cache == buf.size()) return false;
+    }
+    buf[h & mask] = tick;
+    head.store(h + 1, memory_order_release);
+    return true;
+  }
+  // @return  the ticks available to the consumer, up to the end of buf.
+  span<const Tick> peek() {
+    const size_t t = tail.load(memory_order_relaxed);
+    if (t == head_cache) head_cache = head.load(memory_order_acquire);
+    return span(buf).subspan(t & mask,
+                             min(head_cache - t, buf.size() - (t & mask)));
+  }
+  void pop(const size_t n) {
+    tail.store(tail.load(memory_order_relaxed) + n, memory_order_release);
+  }
+  bool empty() const {
+    return tail.load(memory_order_acquire) == head.load(memory_order_acquire);
+  }
+};
+
+// Multi-threaded SMA service
+// Symbol s belongs to shard s % Shards, whose thread owns an SMA_batch of
+// its symbols. Each producer has its own SPSC ring into every shard, so all
+// ticks of a symbol must come from one producer. A shard applies whatever
+// its rings hold as a batch, then publishes the SMAs of the touched symbols
+// under a seqlock, so that readers never block it.
+class SMA_service {
+ public:
+  using Tick = SMA_batch<>::Tick;
+
+ private:
+  struct Shard {
+    SMA_batch<> engine;
+    vector<unique_ptr<SPSC_ring>> rings;  // rings[producer]
+    // seq is odd while results are being published
+    alignas(64) atomic<uint64_t> seq;
+    vector<atomic<my_float_t>> results;
+    jthread thread;
+    Shard(const my_int_t Symbols, const my_int_t Bin, const my_float_t Win)
+        : engine(Symbols, Bin, Win), seq(0), results(Symbols) {
+      for (auto& result : results) result = nanl("SMA is undefined.");
+    }
+  };
+  const my_int_t Shards;
+  vector<unique_ptr<Shard>> shards;
+
+ public:
+  SMA_service(const my_int_t Symbols, const my_int_t Bin, const my_float_t Win,
+              const my_int_t Producers = 1,
+              const my_int_t Shards_ = thread::hardware_concurrency(),
+              const size_t Capacity = 1 << 16)
+      : Shards(max<my_int_t>(Shards_, 1)) {
+    assert(Symbols > 0 && Producers > 0);
+    for (my_int_t k = 0; k < Shards; k++) {
+      const my_int_t symbols =
+          max<my_int_t>((Symbols - k + Shards - 1) / Shards, 1);
+      auto& shard = shards.emplace_back(make_unique<Shard>(symbols, Bin, Win));
+      for (my_int_t p = 0; p < Producers; p++) {
+        shard->rings.push_back(make_unique<SPSC_ring>(Capacity));
+      }
+    }
+    for (auto& shard : shards) {
+      shard->thread = jthread([&shard = *shard](const stop_token stop) {
+        run(shard, stop);
+      });
+    }
+  }
+
+ private:
+  static void run(Shard& shard, const stop_token stop) {
+    for (bool idle = false; !(idle && stop.stop_requested());) {
+      idle = true;
+      for (auto& ring : shard.rings) {
+        const span<const Tick> ticks = ring->peek();
+        if (ticks.empty()) continue;
+        idle = false;
+        shard.engine.update(ticks);
+        const uint64_t seq = shard.seq.load(memory_order_relaxed);
+        shard.seq.store(seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (const Tick& tick : ticks) {
+          shard.results[tick.symbol].store(shard.engine.get(tick.symbol),
+                                           memory_order_relaxed);
+        }
+        shard.seq.store(seq + 2, memory_order_release);
+        ring->pop(ticks.size());
+      }
+      if (idle) this_thread::yield();
+    }
+  }
+
+ public:
+  // Enqueues tick from producer p, waiting while its ring is full.
+  void push(const my_int_t p, const Tick& tick) {
+    SPSC_ring& ring = *shards[tick.symbol % Shards]->rings[p];
+    while (!ring.push({tick.symbol / Shards, tick.time, tick.price})) {
+      this_thread::yield();
+    }
+  }
+  // Waits until every tick pushed so far is applied and published.
+  void wait() const {
+    for (const auto& shard : shards) {
+      for (const auto& ring : shard->rings) {
+        while (!ring->empty()) this_thread::yield();
+      }
+    }
+  }
+  // @return  the SMA of symbol as of the last batch applied by its shard.
+  my_float_t get(const my_int_t symbol) const {
+    const Shard& shard = *shards[symbol % Shards];
+    for (;;) {
+      const uint64_t seq = shard.seq.load(memory_order_acquire);
+      const my_float_t sma =
+          shard.results[symbol / Shards].load(memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+      if (seq % 2 == 0 && shard.seq.load(memory_order_relaxed) == seq) {
+        return sma;
+      }
+      this_thread::yield();
+    }
+  }
+  // sma[s] = get(s) for every symbol, the symbols of each shard as of one
+  // batch.
+  void get(const span<my_float_t> sma) const {
+    for (my_int_t k = 0; k < Shards; k++) {
+      const Shard& shard = *shards[k];
+      for (;;) {
+        const uint64_t seq = shard.seq.load(memory_order_acquire);
+        for (size_t s = k; s < sma.size(); s += Shards) {
+          sma[s] = shard.results[s / Shards].load(memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (seq % 2 == 0 && shard.seq.load(memory_order_relaxed) == seq) {
+          break;
+        }
+        this_thread::yield();
+      }
+    }
   }
 };
 
 using MovingAverage = SMA<true>;
 using MovingAverage_std = SMA<false>;
 
-int main() {
-  my_float_t Win;     // conventions #2
-  my_int_t Bin;       // conventions #2
-  cin >> Win >> Bin;  // conventions #7
-  my_float_t t, p;    // conventions #6
+// Maps the input read-only, or reads it into memory if it is not a file.
+string_view read_input(const int fd) {
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if (st.st_size == 0) return {};
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      return {static_cast<const char*>(addr), size_t(st.st_size)};
+    }
+  }
+  // one buffer per input, as the views outlive the calls
+  static deque<string> buffers;
+  string& data = buffers.emplace_back();
+  data.resize(1 << 16);
+  for (size_t len = 0;;) {
+    if (len == data.size()) data.resize(len * 2);
+    const ssize_t ret = read(fd, data.data() + len, data.size() - len);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret == -1) {
+      fprintf(stderr, "Error: cannot read the input.\n");
+      exit(1);
+    }
+    if (ret == 0) return string_view(data).substr(0, len);
+    len += ret;
+  }
+}
+
+// Reads whitespace-separated numbers, as cin >> does.
+class Text_reader {
+  const char *pos, *const end;
+
+ public:
+  explicit Text_reader(const string_view in)
+      : pos(in.data()), end(in.data() + in.size()) {}
+  template <typename T>
+  bool read(T& value) {
+    while (pos < end && isspace(static_cast<unsigned char>(*pos))) pos++;
+    if (pos < end && *pos == '+') pos++;  // from_chars rejects it
+    const auto [ptr, ec] = from_chars(pos, end, value);
+    if (ec != errc()) return false;
+    pos = ptr;
+    return true;
+  }
+};
+
+// Buffers the output, which is written in large chunks.
+class Writer {
+  const int fd;
+  string buf;
+
+ public:
+  explicit Writer(const int fd_) : fd(fd_) { buf.reserve(1 << 16); }
+  ~Writer() { flush(); }
+  void flush() {
+    for (size_t pos = 0; pos < buf.size();) {
+      const ssize_t ret = write(fd, buf.data() + pos, buf.size() - pos);
+      if (ret == -1 && errno == EINTR) continue;
+      if (ret == -1) {
+        fprintf(stderr, "Error: cannot write the output.\n");
+        exit(1);
+      }
+      pos += ret;
+    }
+    buf.clear();
+  }
+  Writer& operator<<(const string_view str) {
+    buf += str;
+    if (buf.size() >= (1 << 16)) flush();
+    return *this;
+  }
+  // As cout << value does, with the default precision of 6.
+  Writer& operator<<(const my_float_t value) {
+    char str[32];
+    return *this << string_view(
+               str, to_chars(str, str + sizeof(str), value,
+                             chars_format::general, 6)
+                            .ptr);
+  }
+  template <typename T>
+  Writer& write_raw(const T& value) {
+    return *this << string_view(reinterpret_cast<const char*>(&value),
+                                sizeof(value));
+  }
+};
+
+// Writes n ticks {Timestamp, Price} of a price with |dP/dt| <= 1, whose
+// slope drifts, at exponentially distributed intervals of mean 1.
+vector<Record> get_lipschitz(const size_t n) {
+  mt19937_64 rng(20210317);
+  exponential_distribution<my_float_t> gap(1);
+  normal_distribution<my_float_t> kick(0, 0.1);
+  vector<Record> ticks(n);
+  my_float_t t = 0, p = 100, slope = 0;
+  for (Record& tick : ticks) {
+    const my_float_t dt = gap(rng) + 1e-3;  // conventions #4
+    p += slope * dt, t += dt;
+    slope = clamp(slope + kick(rng), my_float_t(-1), my_float_t(1));
+    tick = {t, p};
+  }
+  return ticks;
+}
+
+// Writes n ticks of a price with Student-t jumps (2 degrees of freedom), at
+// Pareto distributed intervals (alpha = 1.5) of mean 1.
+vector<Record> get_heavy_tailed(const size_t n) {
+  mt19937_64 rng(20210317);
+  uniform_real_distribution<my_float_t> uniform(0, 1);
+  student_t_distribution<my_float_t> jump(2);
+  vector<Record> ticks(n);
+  my_float_t t = 0, p = 100;
+  for (Record& tick : ticks) {
+    t += 1 / (3 * pow(1 - uniform(rng), 1 / 1.5));
+    p += 0.1 * jump(rng);
+    tick = {t, p};
+  }
+  return ticks;
+}
+
+// keeps the throughput loop of bench_sma() from being optimized away
+volatile my_float_t bench_sink;
+
+struct Bench_result {
+  string series, policy;
+  my_float_t Win;
+  my_int_t Bin;                    // 0 for SMA<false>
+  my_int_t Symbols;                // 1 but for SMA_batch and its baseline
+  double ticks_per_s;
+  double p50_ns, p99_ns, p999_ns;  // latency of update(...).get()
+  size_t bytes;                    // peak memory of all the symbols
+  my_float_t max_err, mean_err;    // against SMA<false>
+};
+
+// Runs n ticks through the SMAs made by make(), once as a whole by run(ma)
+// for the throughput, and once tick by tick by step(ma, i), which returns
+// the SMA after tick i, for the latency, the memory and the error against
+// ref, the outputs of SMA<false>.
+template <typename Make, typename Run, typename Step>
+Bench_result bench_sma(const size_t n, const vector<my_float_t>& ref,
+                       const Make& make, const Run& run, const Step& step) {
+  using clock = chrono::steady_clock;
+  Bench_result result = {};
+  result.Symbols = 1;
+  {
+    auto ma = make();
+    const auto start = clock::now();
+    const my_float_t sum = run(ma);
+    const chrono::duration<double> wall = clock::now() - start;
+    result.ticks_per_s = n / wall.count();
+    bench_sink = sum;
+  }
+  auto ma = make();
+  vector<double> latency(n);
+  size_t err_cnt = 0;
+  for (size_t i = 0; i < n; i++) {
+    const auto tick = clock::now();
+    const my_float_t sma = step(ma, i);
+    latency[i] = chrono::duration<double, nano>(clock::now() - tick).count();
+    result.bytes = max(result.bytes, ma.memory());
+    const my_float_t err = abs(sma - ref[i]);
+    if (isnan(err)) continue;  // conventions #9
+    result.max_err = max(result.max_err, err);
+    result.mean_err += err, err_cnt++;
+  }
+  result.mean_err /= max(err_cnt, size_t(1));
+  sort(latency.begin(), latency.end());
+  const auto percentile = [&](const double q) {
+    return latency[min(size_t(q * latency.size()), latency.size() - 1)];
+  };
+  result.p50_ns = percentile(0.5);
+  result.p99_ns = percentile(0.99);
+  result.p999_ns = percentile(0.999);
+  return result;
+}
+
+// Runs the ticks of one series, the SMA being read by get(ma).
+template <typename Make, typename Get>
+Bench_result bench_sma(const vector<Record>& ticks,
+                       const vector<my_float_t>& ref, const Make& make,
+                       const Get& get) {
+  const auto step = [&](auto& ma, const size_t i) {
+    return get(ma.update(ticks[i].first, ticks[i].second));
+  };
+  const auto run = [&](auto& ma) {
+    my_float_t sum = 0;
+    for (size_t i = 0; i < ticks.size(); i++) sum += step(ma, i);
+    return sum;
+  };
+  return bench_sma(ticks.size(), ref, make, run, step);
+}
+
+template <typename Make>
+Bench_result bench_sma(const vector<Record>& ticks,
+                       const vector<my_float_t>& ref, const Make& make) {
+  return bench_sma(ticks, ref, make, [](const auto& ma) { return ma.get(); });
+}
+
+// SMA<true> objects, one per symbol, the baseline of SMA_batch.
+class SMA_objects {
+  vector<SMA<true>> mas;
+
+ public:
+  SMA_objects(const my_int_t Symbols, const my_int_t Bin, const my_float_t Win)
+      : mas(Symbols, SMA<true>(Bin, Win)) {}
+  SMA_objects& update(const my_int_t s, const my_float_t t,
+                      const my_float_t p) {
+    mas[s].update(t, p);
+    return *this;
+  }
+  my_float_t get(const my_int_t s) const { return mas[s].get(); }
+  size_t memory() const {
+    size_t bytes = sizeof(*this);
+    for (const SMA<true>& ma : mas) bytes += ma.memory();
+    return bytes;
+  }
+};
+
+// Spreads the ticks of series over Symbols symbols at random, each symbol
+// replaying series from its start.
+vector<SMA_batch<>::Tick> spread(const vector<Record>& series,
+                                 const my_int_t Symbols) {
+  mt19937_64 rng(20210317);
+  vector<SMA_batch<>::Tick> ticks(series.size());
+  vector<size_t> replayed(Symbols, 0);
+  for (SMA_batch<>::Tick& tick : ticks) {
+    const my_int_t s = rng() % Symbols;
+    const auto& [t, p] = series[replayed[s]++];
+    tick = {s, t, p};
+  }
+  return ticks;
+}
+
+// Runs the ticks of series, spread over Symbols symbols, through
+// SMA_objects, tick by tick, and SMA_batch, in batches of batch_size ticks.
+void bench_batch(const vector<Record>& series, const my_int_t Symbols,
+                 const my_int_t Bin, const my_float_t Win,
+                 vector<Bench_result>& results) {
+  constexpr size_t batch_size = 4096;
+  const vector<SMA_batch<>::Tick> ticks = spread(series, Symbols);
+  vector<my_float_t> ref;
+  vector<SMA<false>> ma_stds(Symbols, SMA<false>(Win));
+  for (const auto& [s, t, p] : ticks) {
+    ref.push_back(ma_stds[s].update(t, p).get());
+  }
+  const auto step = [&](auto& ma, const size_t i) {
+    const auto& [s, t, p] = ticks[i];
+    return ma.update(s, t, p).get(s);
+  };
+  results.push_back(bench_sma(
+      ticks.size(), ref, [&] { return SMA_objects(Symbols, Bin, Win); },
+      [&](SMA_objects& ma) {
+        my_float_t sum = 0;
+        for (size_t i = 0; i < ticks.size(); i++) sum += step(ma, i);
+        return sum;
+      },
+      step));
+  results.back().policy = "merge_nearest";
+  results.push_back(bench_sma(
+      ticks.size(), ref, [&] { return SMA_batch(Symbols, Bin, Win); },
+      [&](SMA_batch<>& ma) {
+        my_float_t sum = 0;
+        for (size_t i = 0; i < ticks.size(); i += batch_size) {
+          const auto batch = span(ticks).subspan(
+              i, min(batch_size, ticks.size() - i));
+          ma.update(batch);
+          for (const SMA_batch<>::Tick& tick : batch) {
+            sum += ma.get(tick.symbol);
+          }
+        }
+        return sum;
+      },
+      step));
+  results.back().policy = "batch";
+  for (size_t k = results.size() - 2; k < results.size(); k++) {
+    results[k].Win = Win, results[k].Bin = Bin, results[k].Symbols = Symbols;
+  }
+}
+
+// Sweeps Win and Bin over the synthetic series with n ticks each, and
+// prints a JSON array of the results.
+void bench(const size_t n) {
+  vector<Bench_result> results;
+  const vector<my_float_t> Wins = {100, 1000, 10000};
+  for (const auto& [series, ticks] :
+       {pair{"lipschitz", get_lipschitz(n)},
+        pair{"heavy_tailed", get_heavy_tailed(n)}}) {
+    for (my_int_t h = 0; h < my_int_t(Wins.size()); h++) {
+      const my_float_t Win = Wins[h];
+      fprintf(stderr, "%s Win=%g\n", series, Win);
+      vector<my_float_t> ref;
+      SMA<false> ma_std(Win);
+      for (const auto& [t, p] : ticks) ref.push_back(ma_std.update(t, p).get());
+      results.push_back(
+          bench_sma(ticks, ref, [&] { return SMA<false>(Win); }));
+      results.back().policy = "exact";
+      results.push_back(bench_sma(ticks, ref, [&] {
+        return SMA<false, Scheme::merge_nearest, Accumulation::plain>(Win);
+      }));
+      results.back().policy = "exact_plain";
+      for (const my_int_t Bin : {8, 32, 128, 512}) {
+        results.push_back(bench_sma(ticks, ref, [&] {
+          return SMA<true, Scheme::merge_nearest>(Bin, Win);
+        }));
+        results.back().policy = "merge_nearest";
+        results.back().Bin = Bin;
+        results.push_back(bench_sma(ticks, ref, [&] {
+          return SMA<true, Scheme::min_duration_product>(Bin, Win);
+        }));
+        results.back().policy = "min_duration_product";
+        results.back().Bin = Bin;
+        // one SMA_multi over all Wins, read at Win
+        results.push_back(bench_sma(
+            ticks, ref, [&] { return SMA_multi(Bin, Wins); },
+            [&](const SMA_multi<>& ma) { return ma.get(h); }));
+        results.back().policy = "multi";
+        results.back().Bin = Bin;
+      }
+      for (size_t k = results.size(); k-- && results[k].series.empty();) {
+        results[k].series = series, results[k].Win = Win;
+      }
+    }
+  }
+  const vector<Record> series = get_lipschitz(n);
+  for (const my_int_t Symbols : {1024, 16384}) {
+    fprintf(stderr, "lipschitz Symbols=%lld\n", (long long)Symbols);
+    bench_batch(series, Symbols, 32, 100, results);
+    for (size_t k = results.size(); k-- && results[k].series.empty();) {
+      results[k].series = "lipschitz";
+    }
+  }
+  printf("[\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Bench_result& r = results[i];
+    printf("  {\"series\": \"%s\", \"policy\": \"%s\", \"Win\": %g, ",
+           r.series.c_str(), r.policy.c_str(), r.Win);
+    printf("\"Bin\": %lld, \"Symbols\": %lld, \"ticks_per_s\": %.0f, ",
+           (long long)r.Bin, (long long)r.Symbols, r.ticks_per_s);
+    printf("\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, ",
+           r.p50_ns, r.p99_ns, r.p999_ns);
+    printf("\"bytes\": %zu, \"max_err\": %.3g, \"mean_err\": %.3g}%s\n",
+           r.bytes, r.max_err, r.mean_err, i + 1 < results.size() ? "," : "");
+  }
+  printf("]\n");
+}
+
+// Runs n ticks, spread over Symbols symbols, through SMA_service from
+// Producers threads, while a reader thread checks that every SMA it reads,
+// one at a time or all at once, is one that a sequential SMA_batch went
+// through for that symbol, never older than the one read before. Small
+// rings make the producers wait on the shards and wrap around often.
+// @return  whether every read, and every SMA after wait(), is as expected.
+bool stress(const size_t n) {
+  constexpr my_int_t Symbols = 64, Bin = 8, Producers = 2, Shards = 3;
+  constexpr my_float_t Win = 100;
+  const vector<SMA_batch<>::Tick> ticks = spread(get_lipschitz(n), Symbols);
+  const my_float_t undefined = nanl("SMA is undefined.");
+  // history[s] = SMAs of symbol s after each of its ticks, from before the
+  // first one
+  vector<vector<my_float_t>> history(Symbols, {undefined});
+  SMA_batch ref(Symbols, Bin, Win);
+  for (const auto& [s, t, p] : ticks) {
+    history[s].push_back(ref.update(s, t, p).get(s));
+  }
+  const auto same = [](const my_float_t a, const my_float_t b) {
+    return a == b || (isnan(a) && isnan(b));
+  };
+
+  SMA_service service(Symbols, Bin, Win, Producers, Shards, 1 << 8);
+  atomic<bool> done = false;
+  size_t reads = 0, bad_reads = 0;
+  jthread reader([&] {
+    // seen[s] = the index in history[s] of the SMA read last
+    vector<size_t> seen(Symbols, 0);
+    const auto check = [&](const my_int_t s, const my_float_t sma) {
+      size_t& k = seen[s];
+      while (k < history[s].size() && !same(history[s][k], sma)) k++;
+      if (k == history[s].size()) bad_reads++, k = 0;
+      reads++;
+    };
+    vector<my_float_t> sma(Symbols);
+    while (!done.load(memory_order_acquire)) {
+      service.get(span(sma));
+      for (my_int_t s = 0; s < Symbols; s++) check(s, sma[s]);
+      const my_int_t s = reads % Symbols;
+      check(s, service.get(s));
+    }
+  });
+  {
+    vector<jthread> producers;
+    for (my_int_t p = 0; p < Producers; p++) {
+      producers.emplace_back([&, p] {
+        for (const SMA_batch<>::Tick& tick : ticks) {
+          if (tick.symbol % Producers == p) service.push(p, tick);
+        }
+      });
+    }
+  }
+  service.wait();
+  done.store(true, memory_order_release);
+  reader.join();
+  size_t bad_finals = 0;
+  for (my_int_t s = 0; s < Symbols; s++) {
+    bad_finals += !same(service.get(s), history[s].back());
+  }
+  fprintf(stderr, "stress: %zu ticks, %zu reads, %zu bad, %zu bad at the end\n",
+          n, reads, bad_reads, bad_finals);
+  return bad_reads == 0 && bad_finals == 0;
+}
+
+// Runs n ticks, delayed at random by up to 1.25 * Lateness and some of them
+// corrected, through SMA_late with Win = 10 and Lateness 2, 5 and 20, and
+// checks every SMA against the step function of the ticks accepted so far,
+// integrated over the window tick by tick. As in SMA_late, a tick is
+// rejected if more than Lateness behind the latest one, and dropped if
+// before the first one.
+// @return  whether every SMA is within 1e-9 of the reference.
+bool check_late(const size_t n) {
+  constexpr my_float_t Win = 10;
+  const vector<Record> series = get_lipschitz(n);
+  bool ok = true;
+  for (const my_float_t Lateness : {2, 5, 20}) {
+    mt19937_64 rng(20210317);
+    uniform_real_distribution<my_float_t> delay(0, 1.25 * Lateness);
+    normal_distribution<my_float_t> revision(0, 1);
+    // arrivals = {{arrival time, tick}...}, a tenth of the ticks being
+    // followed by a correction
+    vector<pair<my_float_t, Record>> arrivals;
+    for (const auto& [t, p] : series) {
+      arrivals.push_back({t + delay(rng), {t, p}});
+      if (rng() % 10 == 0) {
+        arrivals.push_back({t + delay(rng), {t, p + revision(rng)}});
+      }
+    }
+    stable_sort(arrivals.begin(), arrivals.end(),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+    SMA_late ma(Win, Lateness);
+    map<my_float_t, my_float_t> accepted;  // accepted[time] = price
+    my_float_t max_err = 0;
+    size_t rejected = 0;
+    for (const auto& [arrival, tick] : arrivals) {
+      const auto [t, p] = tick;
+      if (!accepted.empty() && t < prev(accepted.end())->first - Lateness) {
+        rejected++;
+        if (ma.update(t, p)) ok = false;
+        continue;
+      }
+      if (!ma.update(t, p)) ok = false;
+      if (accepted.empty() || t >= accepted.begin()->first) accepted[t] = p;
+      const my_float_t latest = prev(accepted.end())->first;
+      const my_float_t from = max(accepted.begin()->first, latest - Win);
+      my_float_t area = 0;
+      for (auto it = prev(accepted.upper_bound(from)); it != accepted.end();) {
+        const auto next = std::next(it);
+        const my_float_t start = max(it->first, from);
+        area += it->second * ((next == accepted.end() ? latest : next->first) -
+                              start);
+        it = next;
+      }
+      const my_float_t sma =
+          latest > from ? area / (latest - from) : nanl("SMA is undefined.");
+      if (isnan(ma.get()) != isnan(sma)) ok = false;  // conventions #9
+      if (!isnan(sma)) max_err = max(max_err, abs(ma.get() - sma));
+    }
+    ok = ok && max_err <= 1e-9;
+    fprintf(stderr,
+            "late: Lateness=%g, %zu ticks, %zu rejected, max_err %.3g\n",
+            Lateness, arrivals.size(), rejected, max_err);
+  }
+  return ok;
+}
+
+// Restores ma and ma_std from the snapshot in file_name (conventions #12).
+bool restore(const char* const file_name, MovingAverage& ma,
+             MovingAverage_std& ma_std) {
+  const int fd = open(file_name, O_RDONLY);
+  if (fd == -1) return false;
+  string_view snapshot = read_input(fd);
+  close(fd);
+  return ma.restore(snapshot) && ma_std.restore(snapshot) && snapshot.empty();
+}
+
+// Writes the snapshot of ma and ma_std to file_name (conventions #12)
+// through a temporary file renamed over it, so that file_name always holds
+// a whole snapshot.
+bool checkpoint(const char* const file_name, const MovingAverage& ma,
+                const MovingAverage_std& ma_std) {
+  string snapshot;
+  ma.checkpoint(snapshot);
+  ma_std.checkpoint(snapshot);
+  const string tmp_name = string(file_name) + ".tmp";
+  const int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) return false;
+  Writer(fd) << snapshot;
+  const bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced && rename(tmp_name.c_str(), file_name) == 0;
+}
+
+// Usage: sol1 [--binary | --pack] [--restore snapshot]
+//             [--checkpoint snapshot] < input > output
+//        sol1 --bench [ticks]
+//        sol1 --stress [ticks]
+//        sol1 --late [ticks]
+// --restore resumes from a snapshot taken with the same Win and Bin, and
+// --checkpoint writes one at the end of input.
+int main(int argc, const char* argv[]) {
+  if (argc > 1 && argv[1] == string_view("--bench") && argc <= 3) {
+    const my_int_t n = argc > 2 ? atoll(argv[2]) : 1 << 20;
+    if (n > 0) {
+      bench(n);
+      return 0;
+    }
+  }
+  if (argc > 1 && argv[1] == string_view("--stress") && argc <= 3) {
+    const my_int_t n = argc > 2 ? atoll(argv[2]) : 1 << 20;
+    if (n > 0) return stress(n) ? 0 : 4;
+  }
+  if (argc > 1 && argv[1] == string_view("--late") && argc <= 3) {
+    const my_int_t n = argc > 2 ? atoll(argv[2]) : 1 << 20;
+    if (n > 0) return check_late(n) ? 0 : 4;
+  }
+  string_view mode;
+  const char *restore_file = nullptr, *checkpoint_file = nullptr;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    const string_view arg = argv[i];
+    if ((arg == "--binary" || arg == "--pack") && mode.empty()) {
+      mode = arg;
+    } else if (arg == "--restore" && i + 1 < argc) {
+      restore_file = argv[++i];
+    } else if (arg == "--checkpoint" && i + 1 < argc) {
+      checkpoint_file = argv[++i];
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    fprintf(stderr,
+            "Usage: %s [--binary | --pack] [--restore snapshot]\n"
+            "          [--checkpoint snapshot] < input > output\n"
+            "       %s --bench [ticks]\n"
+            "       %s --stress [ticks]\n"
+            "       %s --late [ticks]\n",
+            argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+  }
+  const string_view in = read_input(STDIN_FILENO);
+  Writer out(STDOUT_FILENO);
+  Text_reader reader(in);
+  Header header;
+  if (mode == "--binary") {
+    if (in.size() < sizeof(header)) return 1;
+    memcpy(&header, in.data(), sizeof(header));
+  } else if (!reader.read(header.Win) || !reader.read(header.Bin)) {
+    return 1;  // conventions #2 #7
+  }
+  const auto& [Win, Bin] = header;
   MovingAverage ma(Bin, Win);
   MovingAverage_std ma_std(Win);
-  while (cin >> t >> p) {  // conventions #1 #3 #7
-    auto out = ma.update(t, p).get();
-    auto err = ma_std.update(t, p).get() - out;
-    cout << out;  // conventions #6
-    cout << (err > 0 ? " (+" : " (") << err << ")" << endl;
+  if (restore_file && !restore(restore_file, ma, ma_std)) {
+    fprintf(stderr, "Error: cannot restore from '%s'\n", restore_file);
+    return 1;
+  }
+  if (mode == "--pack") out.write_raw(header);
+  for (size_t pos = sizeof(header);;) {
+    Record tick;  // {t, p}
+    if (mode == "--binary") {
+      if (in.size() - pos < sizeof(tick)) break;  // conventions #10
+      memcpy(&tick, in.data() + pos, sizeof(tick));
+      pos += sizeof(tick);
+    } else if (!reader.read(tick.first) || !reader.read(tick.second)) {
+      break;  // conventions #1 #3 #7
+    }
+    const auto [t, p] = tick;
+    if (mode == "--pack") {
+      out.write_raw(tick);
+      continue;
+    }
+    auto sma = ma.update(t, p).get();
+    auto err = ma_std.update(t, p).get() - sma;
+    if (mode == "--binary") {
+      out.write_raw(Record{sma, err});  // conventions #11
+    } else {
+      out << sma;  // conventions #6
+      out << (err > 0 ? " (+" : " (") << err << ")\n";
+    }
+  }
+  if (checkpoint_file && !checkpoint(checkpoint_file, ma, ma_std)) {
+    fprintf(stderr, "Error: cannot write '%s'\n", checkpoint_file);
+    return 1;
   }
-}
\ No newline at end of file
+}